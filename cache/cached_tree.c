@@ -2,9 +2,172 @@
 #include <string.h>
 #include <errno.h>
 #include <stdlib.h>
+#include <stddef.h>
+#include <stdio.h>
 
 #include "cached_tree.h"
 
+#ifdef _WIN32
+#  define WIN32_LEAN_AND_MEAN
+#  include <windows.h>
+#else
+#  include <sys/mman.h>
+#endif
+
+/// commits happen in steps of this many bytes
+#define ARENA_GRANULE 65536
+
+static size_t ArenaBytes(uint32_t count, size_t element_size)
+{
+    const size_t bytes = (size_t)count * element_size;
+    return (bytes + (ARENA_GRANULE - 1)) & ~(size_t)(ARENA_GRANULE - 1);
+}
+
+static int CommitArena(uint8_t* base, size_t from, size_t to)
+{
+    if (to <= from)
+        return 1;
+#ifdef _WIN32
+    return VirtualAlloc(base + from, to - from, MEM_COMMIT, PAGE_READWRITE) != 0;
+#else
+    return mprotect(base + from, to - from, PROT_READ | PROT_WRITE) == 0;
+#endif
+}
+
+void* ReserveArena(uint32_t max_count, size_t element_size, uint32_t count)
+{
+    const size_t reserve = ArenaBytes(max_count, element_size);
+#ifdef _WIN32
+    uint8_t* base = (uint8_t*)
+        VirtualAlloc(0, reserve, MEM_RESERVE, PAGE_NOACCESS);
+#else
+    uint8_t* base = (uint8_t*) mmap(0, reserve, PROT_NONE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == (uint8_t*) MAP_FAILED)
+        base = 0;
+#endif
+    if (base && !CommitArena(base, 0, ArenaBytes(count, element_size)))
+        base = 0;
+
+    return base;
+}
+
+static void ReleaseArena(void* base, uint32_t max_count, size_t element_size)
+{
+#ifdef _WIN32
+    (void) max_count;
+    (void) element_size;
+    VirtualFree(base, 0, MEM_RELEASE);
+#else
+    munmap(base, ArenaBytes(max_count, element_size));
+#endif
+}
+
+void GrowArena(void* base, uint32_t* capacity, uint32_t max_count,
+               size_t element_size, uint32_t needed)
+{
+    if (needed <= *capacity)
+        return;
+
+    uint32_t new_capacity = *capacity * 2;
+    if (new_capacity < needed)
+        new_capacity = needed;
+    if (new_capacity > max_count)
+        new_capacity = max_count;
+
+    // the callers write right behind the old capacity, going on
+    // without the memory would fault somewhere far away
+    const size_t committed = ArenaBytes(*capacity, element_size);
+    const size_t to = ArenaBytes(new_capacity, element_size);
+    if (needed > new_capacity
+     || !CommitArena((uint8_t*) base, committed, to))
+    {
+        fprintf(stderr, "cache: can't grow an arena to %u of %u elements\n",
+                needed, max_count);
+        abort();
+    }
+
+    // the granule may hold a few more elements than asked for
+    const size_t fits = to / element_size;
+    *capacity = (fits < max_count) ? (uint32_t) fits : max_count;
+}
+
+static void PushFree(freelist_entry_t** list, void* slot, entry_type_t type)
+{
+    freelist_entry_t* node = (freelist_entry_t*) slot;
+    node->entry_type = type;
+    node->entry = slot;
+    node->next = *list;
+    *list = node;
+}
+
+static void* PopFree(freelist_entry_t** list)
+{
+    freelist_entry_t* node = *list;
+    if (!node)
+        return 0;
+
+    *list = node->next;
+    return node->entry;
+}
+
+cached_dir_t* NewCachedDir(cache_t* cache)
+{
+    // the free list only overwrites the front, attribs survive
+    assert(sizeof(freelist_entry_t) <= offsetof(cached_dir_t, attribs));
+
+    uint32_t generation = 0;
+    cached_dir_t* result = (cached_dir_t*) PopFree(&cache->free_dirs);
+    if (result)
+    {
+        generation = result->attribs.generation + 1;
+    }
+    else
+    {
+        GrowArena(cache->dir_entries, &cache->dir_entries_capacity,
+                  CACHE_MAX_DIRS, sizeof(cached_dir_t), cache->dir_entries_size + 1);
+        result = cache->dir_entries + cache->dir_entries_size++;
+    }
+    memset(result, 0, sizeof(cached_dir_t));
+    result->attribs.generation = generation;
+
+    return result;
+}
+
+cached_file_t* NewCachedFile(cache_t* cache)
+{
+    assert(sizeof(freelist_entry_t) <= offsetof(cached_file_t, attribs));
+
+    uint32_t generation = 0;
+    cached_file_t* result = (cached_file_t*) PopFree(&cache->free_files);
+    if (result)
+    {
+        generation = result->attribs.generation + 1;
+    }
+    else
+    {
+        GrowArena(cache->file_entries, &cache->file_entries_capacity,
+                  CACHE_MAX_FILES, sizeof(cached_file_t), cache->file_entries_size + 1);
+        result = cache->file_entries + cache->file_entries_size++;
+    }
+    memset(result, 0, sizeof(cached_file_t));
+    result->attribs.generation = generation;
+
+    return result;
+}
+
+#if defined(__AVX2__)
+#  include <immintrin.h>
+#  define DIR_SCAN_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) \
+   || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  include <emmintrin.h>
+#  define DIR_SCAN_SSE2
+#elif defined(__ARM_NEON)
+#  include <arm_neon.h>
+#  define DIR_SCAN_NEON
+#endif
+
 static int err;
 
 typedef struct counted_string
@@ -30,112 +193,622 @@ counted_string StripLastComponent(counted_string *path)
     }
 }
 #endif
-meta_data_entry_t* LookupDirPathByKey(cache_t* cache, const char* dir_path,
-                                      uint32_t entry_key)
+static inline uint32_t TocHash(uint32_t path_crc32, uint32_t path_length)
 {
-    uint32_t toc_size = cache->toc_size;
-    meta_data_entry_t* result = 0;
-    size_t path_length = (entry_key >> 16);
+    return path_crc32 ^ (path_length * 0x9E3779B1);
+}
+
+/// Returns: the slot of the toc hash which points at toc_index
+static uint32_t TocSlotOf(const cache_t* cache, uint32_t toc_index)
+{
+    const toc_entry_t* toc_entry = cache->toc_entries + toc_index;
+    uint32_t slot = TocHash(toc_entry->path_crc32, toc_entry->path_length)
+                  & cache->toc_hash_mask;
+    while(cache->toc_hash[slot] != toc_index + 1)
+    {
+        assert(cache->toc_hash[slot]);
+        slot = (slot + 1) & cache->toc_hash_mask;
+    }
+
+    return slot;
+}
+
+static void InsertTocSlot(cache_t* cache, uint32_t toc_index)
+{
+    const toc_entry_t* toc_entry = cache->toc_entries + toc_index;
+    uint32_t slot = TocHash(toc_entry->path_crc32, toc_entry->path_length)
+                  & cache->toc_hash_mask;
+    while(cache->toc_hash[slot])
+        slot = (slot + 1) & cache->toc_hash_mask;
+
+    cache->toc_hash[slot] = toc_index + 1;
+}
+
+/// doubles the slots of the toc hash and inserts all entries again
+static void GrowTocHash(cache_t* cache)
+{
+    const uint32_t slots = (cache->toc_hash_mask + 1) * 2;
+    cache->toc_hash = (uint32_t*)
+        realloc(cache->toc_hash, slots * sizeof(uint32_t));
+    memset(cache->toc_hash, 0, slots * sizeof(uint32_t));
+    cache->toc_hash_mask = slots - 1;
+
+    for(uint32_t i = 0; i < cache->toc_size; i++)
+        InsertTocSlot(cache, i);
+}
+
+/// backward shift deletion, entries further down the probe sequence
+/// move into the hole so lookups never have to skip over tombstones
+static void RemoveTocSlot(cache_t* cache, uint32_t slot)
+{
+    const uint32_t mask = cache->toc_hash_mask;
+    uint32_t hole = slot;
+    for(uint32_t next = (hole + 1) & mask;
+        cache->toc_hash[next];
+        next = (next + 1) & mask)
+    {
+        const toc_entry_t* toc_entry =
+            cache->toc_entries + (cache->toc_hash[next] - 1);
+        const uint32_t home =
+            TocHash(toc_entry->path_crc32, toc_entry->path_length) & mask;
+        // it may only move back if the hole is not in front of its home
+        if (((next - home) & mask) >= ((next - hole) & mask))
+        {
+            cache->toc_hash[hole] = cache->toc_hash[next];
+            hole = next;
+        }
+    }
+
+    cache->toc_hash[hole] = 0;
+}
+
+/// v must not be 0, 32 bits so 32 bit MSVC builds have it too
+static inline uint32_t LowestSetBit(uint32_t v)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, v);
+    return index;
+#else
+    return __builtin_ctz(v);
+#endif
+}
+
+/// Returns: the position of the first key at or after begin which
+///          equals key, end if there is none
+static uint32_t FindEntryKey(const uint32_t* keys, uint32_t begin,
+                             uint32_t end, uint32_t key)
+{
+    uint32_t i = begin;
+#if defined(DIR_SCAN_AVX2)
+    const __m256i needle = _mm256_set1_epi32((int)key);
+    for(; i + 16 <= end; i += 16)
+    {
+        const __m256i a = _mm256_loadu_si256((const __m256i*)(keys + i));
+        const __m256i b = _mm256_loadu_si256((const __m256i*)(keys + i + 8));
+        const uint32_t mask =
+            (uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(a, needle)))
+          | ((uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(b, needle))) << 8);
+        if (mask)
+            return i + LowestSetBit(mask);
+    }
+#elif defined(DIR_SCAN_SSE2)
+    const __m128i needle = _mm_set1_epi32((int)key);
+    for(; i + 8 <= end; i += 8)
+    {
+        const __m128i a = _mm_loadu_si128((const __m128i*)(keys + i));
+        const __m128i b = _mm_loadu_si128((const __m128i*)(keys + i + 4));
+        const uint32_t mask =
+            (uint32_t)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(a, needle)))
+          | ((uint32_t)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(b, needle))) << 4);
+        if (mask)
+            return i + LowestSetBit(mask);
+    }
+#elif defined(DIR_SCAN_NEON)
+    const uint32x4_t needle = vdupq_n_u32(key);
+    for(; i + 8 <= end; i += 8)
+    {
+        // narrowing the lane masks leaves 16 bits per key
+        const uint16x8_t eq = vcombine_u16(
+            vmovn_u32(vceqq_u32(vld1q_u32(keys + i), needle)),
+            vmovn_u32(vceqq_u32(vld1q_u32(keys + i + 4), needle)));
+        const uint8x8_t narrow = vmovn_u16(eq);
+        const uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(narrow), 0);
+        if ((uint32_t)mask)
+            return i + (LowestSetBit((uint32_t)mask) >> 3);
+        if (mask)
+            return i + 4 + (LowestSetBit((uint32_t)(mask >> 32)) >> 3);
+    }
+#endif
+    for(; i < end; i++)
+    {
+        if (keys[i] == key)
+            break;
+    }
+
+    return i;
+}
+
+static inline uint32_t DirIndexHash(uint32_t entry_key)
+{
+    const uint32_t hash = entry_key * 0x9E3779B1;
+    return hash ^ (hash >> 16);
+}
+
+static void InsertDirIndexSlot(cached_dir_t* dir, uint32_t position)
+{
+    uint32_t slot = DirIndexHash(dir->entry_keys[position])
+                  & dir->index_mask;
+    while(dir->index[slot])
+        slot = (slot + 1) & dir->index_mask;
+
+    dir->index[slot] = position + 1;
+}
+
+/// (re)builds the index of dir with room for it to double
+static void BuildDirIndex(cached_dir_t* dir)
+{
+    uint32_t slots = DIR_INDEX_MIN_ENTRIES * 2;
+    while(slots < dir->entries_size * 4)
+        slots *= 2;
+
+    dir->index = (uint32_t*) realloc(dir->index, slots * sizeof(uint32_t));
+    memset(dir->index, 0, slots * sizeof(uint32_t));
+    dir->index_mask = slots - 1;
+
+    for(uint32_t i = 0; i < dir->entries_size; i++)
+        InsertDirIndexSlot(dir, i);
+}
+
+/// adds the entry which was just appended to dir to its index
+static void IndexLastEntry(cached_dir_t* dir)
+{
+    if (!dir->index)
+        return;
+
+    // a load above one half makes the probe sequences long
+    if (dir->entries_size * 2 > dir->index_mask + 1)
+        BuildDirIndex(dir);
+    else
+        InsertDirIndexSlot(dir, dir->entries_size - 1);
+}
+
+/// Returns: the slot of the index of dir which points at position
+static uint32_t DirIndexSlotOf(const cached_dir_t* dir, uint32_t position)
+{
+    uint32_t slot = DirIndexHash(dir->entry_keys[position])
+                  & dir->index_mask;
+    while(dir->index[slot] != position + 1)
+    {
+        assert(dir->index[slot]);
+        slot = (slot + 1) & dir->index_mask;
+    }
+
+    return slot;
+}
+
+/// backward shift deletion, like RemoveTocSlot
+static void RemoveDirIndexSlot(cached_dir_t* dir, uint32_t slot)
+{
+    const uint32_t mask = dir->index_mask;
+    uint32_t hole = slot;
+    for(uint32_t next = (hole + 1) & mask;
+        dir->index[next];
+        next = (next + 1) & mask)
+    {
+        const uint32_t home =
+            DirIndexHash(dir->entry_keys[dir->index[next] - 1]) & mask;
+        if (((next - home) & mask) >= ((next - hole) & mask))
+        {
+            dir->index[hole] = dir->index[next];
+            hole = next;
+        }
+    }
+
+    dir->index[hole] = 0;
+}
 
-    toc_entry_t* one_past_last = cache->toc_entries + toc_size;
-    for(toc_entry_t* toc_entry = cache->toc_entries;
-        toc_entry < one_past_last; toc_entry++)
+meta_data_entry_t* LookupDirPathByKey(cache_t* cache, const char* dir_path,
+                                      size_t path_length, uint32_t path_crc32)
+{
+    const uint32_t mask = cache->toc_hash_mask;
+    uint32_t slot = TocHash(path_crc32, (uint32_t)path_length) & mask;
+    for(uint32_t v = cache->toc_hash[slot];
+        v;
+        slot = (slot + 1) & mask, v = cache->toc_hash[slot])
     {
-        if (toc_entry->entry_key == entry_key)
+        const toc_entry_t* toc_entry = cache->toc_entries + (v - 1);
+        if (toc_entry->path_crc32 == path_crc32
+            && toc_entry->path_length == path_length)
         {
             const char* entry_path =
                 (toc_entry->relative_name_pointer.v - 4)
                 + cache->name_stringtable;
             if (!memcmp(entry_path, dir_path, path_length))
-            {
-                result = toc_entry->entry;
-                break;
-            }
+                return toc_entry->entry;
         }
     }
 
-    return result;
+    return 0;
+}
+
+/// fills result with the handle v stands for, its limbs are in limbs
+static void DecodeHandle(const cache_t* cache, uint32_t v,
+                         const uint32_t* limbs, fhandle3* result)
+{
+    uint32_t* result_limbs = (uint32_t*)result->handle;
+    const uint32_t prefix = HANDLE_PREFIX(v);
+
+    memset(result, 0, sizeof(fhandle3));
+    if (v == 1)
+    {
+        *result = cache->rootHandle;
+        return;
+    }
+
+    if (prefix)
+    {
+        const handle_prefix_t* handle_prefix = cache->handle_prefixes + (prefix - 1);
+        memcpy(result_limbs, handle_prefix->limbs,
+               handle_prefix->length * sizeof(uint32_t));
+        result_limbs += handle_prefix->length;
+    }
+
+    memcpy(result_limbs, limbs + (v & HANDLE_OFFSET_MASK),
+           HANDLE_LENGTH(v) * sizeof(uint32_t));
+    result_limbs += HANDLE_LENGTH(v);
+
+    result->length = (uint32_t)((uint8_t*)result_limbs - result->handle)
+                   - HANDLE_PADDING(v);
 }
 
 fhandle3 ptrToHandle(cache_t* cache, filehandle_ptr_t fh_ptr)
 {
-    fhandle3 result = {{0}};
+    fhandle3 result;
+    DecodeHandle(cache, fh_ptr.v, cache->limbs, &result);
+    return result;
+}
 
-    const uint32_t ptr = fh_ptr.v & ((1 << 27) - 1);
-    const uint32_t compressed_bit = (fh_ptr.v & (1 << 31));
-    const uint32_t ptr_length = ((fh_ptr.v >> 27) & 15);
-    if (fh_ptr.v == 1)
+/// Returns: the slot holding the handle with these bits and limbs
+///          or the free slot where it would go
+static uint32_t HandleSlotOf(const cache_t* cache, uint32_t crc32,
+                             uint32_t handle_bits, const uint32_t* handle_limbs)
+{
+    const uint32_t mask = cache->handle_slots_mask;
+    const uint32_t length = HANDLE_LENGTH(handle_bits);
+
+    uint32_t slot = crc32 & mask;
+    for(; cache->handle_slots[slot].handle.v; slot = (slot + 1) & mask)
     {
-        result = cache->rootHandle;
+        const handle_slot_t* handle_slot = cache->handle_slots + slot;
+        const uint32_t v = handle_slot->handle.v;
+        if (handle_slot->crc32 == crc32
+         && (v & ~HANDLE_OFFSET_MASK) == handle_bits
+         && !memcmp(cache->limbs + (v & HANDLE_OFFSET_MASK),
+                    handle_limbs, length * sizeof(uint32_t)))
+        {
+            break;
+        }
     }
-    int start_copy_limbs   = 0;
-    int limbs_to_be_copied = ptr_length;
 
-    if (compressed_bit)
+    return slot;
+}
+
+static void InsertHandleSlot(cache_t* cache, const handle_slot_t* handle_slot)
+{
+    const uint32_t mask = cache->handle_slots_mask;
+    uint32_t slot = handle_slot->crc32 & mask;
+    while(cache->handle_slots[slot].handle.v)
+        slot = (slot + 1) & mask;
+
+    cache->handle_slots[slot] = *handle_slot;
+}
+
+static void GrowHandleSlots(cache_t* cache)
+{
+    handle_slot_t* old_slots = cache->handle_slots;
+    const uint32_t old_count = cache->handle_slots_mask + 1;
+
+    const uint32_t slots = old_count * 2;
+    cache->handle_slots = (handle_slot_t*)
+        calloc(slots, sizeof(handle_slot_t));
+    assert(cache->handle_slots);
+    cache->handle_slots_mask = slots - 1;
+
+    for(uint32_t i = 0; i < old_count; i++)
     {
-        (*(((uint32_t*)result.handle) + 0)) = 0x1000001;
-        (*(((uint32_t*)result.handle) + 1)) = (*((uint32_t*)(cache->rootHandle.handle + 4)));
-        (*(((uint32_t*)result.handle) + 2)) = (*((uint32_t*)(cache->rootHandle.handle + 8)));
-        start_copy_limbs = 3;
+        if (old_slots[i].handle.v)
+            InsertHandleSlot(cache, old_slots + i);
     }
+    free(old_slots);
+}
 
-    uint32_t* limb_start = cache->limbs + ptr;
+static void RemoveHandleSlot(cache_t* cache, uint32_t slot)
+{
+    handle_slot_t* slots = cache->handle_slots;
+    const uint32_t mask = cache->handle_slots_mask;
+    uint32_t hole = slot;
+    for(uint32_t next = (hole + 1) & mask;
+        slots[next].handle.v;
+        next = (next + 1) & mask)
+    {
+        const uint32_t home = slots[next].crc32 & mask;
+        // it may only move back if the hole is not in front of its home
+        if (((next - home) & mask) >= ((next - hole) & mask))
+        {
+            slots[hole] = slots[next];
+            hole = next;
+        }
+    }
 
-    // printf("Limbs to be copied: %d\n", limbs_to_be_copied);
+    slots[hole].handle.v = 0;
+}
 
-    uint32_t* one_past_last = cache->limbs + ptr + limbs_to_be_copied;
-    for(uint32_t* limb = limb_start;
-        limb < one_past_last;
-        limb++)
+static void ClearHandleSlots(cache_t* cache)
+{
+    memset(cache->handle_slots, 0,
+           (cache->handle_slots_mask + 1) * sizeof(handle_slot_t));
+    cache->handle_count = 0;
+}
+
+/// Returns: the handle with the length and compressed bits of
+///          handle_bits and these limbs, stored if it wasn't yet
+static filehandle_ptr_t InternHandleLimbs(cache_t* cache, uint32_t handle_bits,
+                                          const uint32_t* handle_limbs)
+{
+    filehandle_ptr_t result = { handle_bits };
+    const uint32_t handle_length = HANDLE_LENGTH(handle_bits);
+    if (!handle_length)
+        return result;
+
+    // twice the slots keeps the probe sequences short
+    if ((cache->handle_count + 1) * 2 > cache->handle_slots_mask + 1)
+        GrowHandleSlots(cache);
+
+    const uint32_t crc32 =
+        crc32c(~0, handle_limbs, handle_length * sizeof(uint32_t));
+    handle_slot_t* handle_slot = cache->handle_slots
+        + HandleSlotOf(cache, crc32, handle_bits, handle_limbs);
+    if (handle_slot->handle.v)
     {
-        *(((uint32_t*)result.handle) + start_copy_limbs++) = *limb;
+        handle_slot->refs++;
+        return handle_slot->handle;
     }
 
+    uint32_t ptr = cache->free_limbs[handle_length];
+    if (ptr)
+    {
+        // a freed run of the same length
+        ptr--;
+        cache->free_limbs[handle_length] = cache->limbs[ptr];
+        cache->dead_limbs -= handle_length;
+    }
+    else
+    {
+        GrowArena(cache->limbs, &cache->limbs_capacity, CACHE_MAX_LIMBS,
+                  sizeof(uint32_t), cache->limbs_size + handle_length + 1);
+        ptr = cache->limbs_size;
+        cache->limbs_size += handle_length;
+    }
+    result.v |= ptr;
+
+    memcpy(cache->limbs + ptr, handle_limbs, handle_length * sizeof(uint32_t));
+
+    handle_slot->crc32 = crc32;
+    handle_slot->handle = result;
+    handle_slot->refs = 1;
+    cache->handle_count++;
+
     return result;
 }
 
-filehandle_ptr_t handleToPtr(cache_t* cache, const fhandle3* handle)
+static uint32_t CommonLimbs(const uint32_t* a, const uint32_t* b,
+                            uint32_t length)
 {
-    filehandle_ptr_t result = {0};
+    uint32_t n = 0;
+    while(n < length && a[n] == b[n])
+        n++;
+    return n;
+}
 
-    const uint32_t* handle_limbs = (uint32_t*)(handle->handle);
+/// a single limb is not worth one of the few prefix slots
+#define HANDLE_MIN_PREFIX 2
 
-    uint32_t handle_length = (fhandle3_length(handle) >> 2);
-    assert(handle_length < 16);
+/// Returns: the handle_prefix_t + 1 of the longest of prefixes which
+///          handle_limbs starts with, 0 for none, every one it starts
+///          with gets a hit, common is raised to the most limbs it has
+///          in common with one of them
+static uint32_t LongestHandlePrefix(handle_prefix_t* prefixes, uint32_t count,
+                                    const uint32_t* handle_limbs,
+                                    uint32_t handle_length, uint32_t* common)
+{
+    uint32_t best = 0;
+    uint32_t best_length = 0;
 
-    if(!memcmp(cache->rootHandle.handle, handle->handle, sizeof(fhandle3)))
+    for(uint32_t i = 0; i < count; i++)
     {
-        result.v = 1;
-        goto Lret;
+        handle_prefix_t* handle_prefix = prefixes + i;
+        const uint32_t n = CommonLimbs(handle_prefix->limbs, handle_limbs,
+            (handle_prefix->length < handle_length)
+            ? handle_prefix->length : handle_length);
+        if (n == handle_prefix->length)
+        {
+            handle_prefix->hits++;
+            if (n > best_length)
+            {
+                best = i + 1;
+                best_length = n;
+            }
+        }
+        if (n > *common)
+            *common = n;
+    }
+
+    return best;
+}
+
+/// Returns: the limbs handle_limbs has in common with the root handle
+///          or the last unmatched handle, at least common
+static uint32_t KnownHandleCommon(const cache_t* cache, const uint32_t* handle_limbs,
+                                  uint32_t handle_length, uint32_t common)
+{
+    // the same handle again, as when a directory is listed twice,
+    // says nothing about what other handles start with
+    const fhandle3* known[2] = { &cache->rootHandle, &cache->unmatched_handle };
+    for(int i = 0; i < 2; i++)
+    {
+        const uint32_t known_length = (fhandle3_length(known[i]) + 3) >> 2;
+        const uint32_t n = CommonLimbs((const uint32_t*)known[i]->handle, handle_limbs,
+            (known_length < handle_length) ? known_length : handle_length);
+        if (n > common && !(n == handle_length && n == known_length))
+            common = n;
     }
 
-    if (handle_limbs[0] == 0x1000001)
+    return common;
+}
+
+static void SetUnmatchedHandle(cache_t* cache, const uint32_t* handle_limbs,
+                               uint32_t handle_length)
+{
+    memset(&cache->unmatched_handle, 0, sizeof(fhandle3));
+    memcpy(cache->unmatched_handle.handle, handle_limbs,
+           handle_length * sizeof(uint32_t));
+    cache->unmatched_handle.length = handle_length * sizeof(uint32_t);
+}
+
+/// learns a candidate from the first length limbs of handle_limbs,
+/// the one with the fewest hits is replaced if there is no room
+static void AddHandleCandidate(cache_t* cache, const uint32_t* handle_limbs,
+                               uint32_t length)
+{
+    uint32_t victim = cache->handle_candidate_count;
+    if (victim == HANDLE_MAX_CANDIDATES)
+    {
+        victim = 0;
+        for(uint32_t i = 1; i < HANDLE_MAX_CANDIDATES; i++)
+        {
+            if (cache->handle_candidates[i].hits
+              < cache->handle_candidates[victim].hits)
+            {
+                victim = i;
+            }
+        }
+    }
+    else
     {
-        const uint32_t root1 = (*(((uint32_t*) cache->rootHandle.handle) + 1));
-        const uint32_t root2 = (*(((uint32_t*) cache->rootHandle.handle) + 2));
+        cache->handle_candidate_count++;
+    }
+
+    handle_prefix_t* candidate = cache->handle_candidates + victim;
+    candidate->length = length;
+    candidate->hits = 1;
+    memcpy(candidate->limbs, handle_limbs, length * sizeof(uint32_t));
+}
+
+/// the candidates with the most hits become the prefixes, one which
+/// only matched the handle it was learned from doesn't
+static void FreezeHandlePrefixes(cache_t* cache)
+{
+    while(cache->handle_prefix_count < HANDLE_MAX_PREFIXES)
+    {
+        uint32_t best = 0;
+        for(uint32_t i = 0; i < cache->handle_candidate_count; i++)
+        {
+            if (!best || cache->handle_candidates[i].hits
+                       > cache->handle_candidates[best - 1].hits)
+            {
+                best = i + 1;
+            }
+        }
+        if (!best || cache->handle_candidates[best - 1].hits < 2)
+            break;
+
+        cache->handle_prefixes[cache->handle_prefix_count++] =
+            cache->handle_candidates[best - 1];
+        cache->handle_candidates[best - 1].hits = 0;
+    }
+    cache->handle_candidate_count = 0;
+}
 
-        if (handle_limbs[1] == root1
-         && handle_limbs[2] == root2)
+/// Returns: the handle_prefix_t + 1 handle_limbs starts with, 0 for none
+///          the first HANDLE_PREFIX_SAMPLES handles only pick the
+///          prefixes, they are stored whole until CompactCache moves
+///          them, later ones without a match may fill a free slot with
+///          what they have in common with a prefix, the root handle or
+///          the last unmatched handle
+static uint32_t MatchHandlePrefix(cache_t* cache, const uint32_t* handle_limbs,
+                                  uint32_t handle_length)
+{
+    uint32_t common = 0;
+    const uint32_t best = LongestHandlePrefix(cache->handle_prefixes,
+        cache->handle_prefix_count, handle_limbs, handle_length, &common);
+    if (best)
+        return best;
+
+    if (cache->handle_samples < HANDLE_PREFIX_SAMPLES)
+    {
+        if (!LongestHandlePrefix(cache->handle_candidates,
+                cache->handle_candidate_count, handle_limbs, handle_length, &common))
         {
-            result.v |= (1 << 31);
-            handle_length -= 3;
-            handle_limbs += 3;
+            common = KnownHandleCommon(cache, handle_limbs, handle_length, common);
+            if (common < HANDLE_MIN_PREFIX)
+                SetUnmatchedHandle(cache, handle_limbs, handle_length);
+            else
+                AddHandleCandidate(cache, handle_limbs, common);
         }
+
+        if (++cache->handle_samples == HANDLE_PREFIX_SAMPLES)
+            FreezeHandlePrefixes(cache);
+        return 0;
     }
-    result.v |= (handle_length << 27);
 
-    assert(cache->limbs_capacity > (cache->limbs_size + handle_length));
-    result.v |= cache->limbs_size;
+    common = KnownHandleCommon(cache, handle_limbs, handle_length, common);
+    if (common < HANDLE_MIN_PREFIX
+     || cache->handle_prefix_count == HANDLE_MAX_PREFIXES)
+    {
+        SetUnmatchedHandle(cache, handle_limbs, handle_length);
+        return 0;
+    }
+
+    handle_prefix_t* handle_prefix =
+        cache->handle_prefixes + cache->handle_prefix_count;
+    handle_prefix->length = common;
+    handle_prefix->hits = 1;
+    memcpy(handle_prefix->limbs, handle_limbs, common * sizeof(uint32_t));
+
+    return ++cache->handle_prefix_count;
+}
+
+filehandle_ptr_t handleToPtr(cache_t* cache, const fhandle3* handle)
+{
+    filehandle_ptr_t result = {0};
+
+    const uint32_t* handle_limbs = (uint32_t*)(handle->handle);
+
+    // the bytes after the end are 0 and pad the last limb
+    const uint32_t length = fhandle3_length(handle);
+    uint32_t handle_length = (length + 3) >> 2;
+    const uint32_t padding = handle_length * 4 - length;
+    assert(length <= NFS3_FHSIZE);
 
-    uint32_t* one_past_last =
-        cache->limbs + cache->limbs_size + handle_length;
+    if(!memcmp(&cache->rootHandle, handle, sizeof(fhandle3)))
+    {
+        result.v = 1;
+        goto Lret;
+    }
 
-    for(uint32_t* dst_limb = cache->limbs + cache->limbs_size;
-        dst_limb < one_past_last; dst_limb++)
+    const uint32_t prefix = MatchHandlePrefix(cache, handle_limbs, handle_length);
+    if (prefix)
     {
-        *dst_limb = *handle_limbs++;
+        const uint32_t prefix_length = cache->handle_prefixes[prefix - 1].length;
+        handle_length -= prefix_length;
+        handle_limbs += prefix_length;
     }
-    cache->limbs_size += handle_length;
+    result.v = (prefix << (HANDLE_OFFSET_BITS + 7))
+             | (padding << (HANDLE_OFFSET_BITS + 5))
+             | (handle_length << HANDLE_OFFSET_BITS);
+
+    result = InternHandleLimbs(cache, result.v, handle_limbs);
 Lret:
     return result;
 }
@@ -163,13 +836,13 @@ meta_data_entry_t* LookupPath(cache_t* cache, const char* full_path,
     const char* last_component_ptr = full_path + (slash_posiiton + 1);
 
     size_t dir_path_size = path_length - (last_component_length + 1);
-    const uint32_t dir_entry_key = EntryKey(full_path, dir_path_size);
+    const uint32_t dir_crc32 = crc32c(~0, full_path, dir_path_size);
 
     meta_data_entry_t* parentDir = cache->root;
     if (dir_path_size)
     {
         parentDir =
-            LookupDirPathByKey(cache, full_path, dir_entry_key);
+            LookupDirPathByKey(cache, full_path, dir_path_size, dir_crc32);
     }
 
     if (!parentDir)
@@ -189,75 +862,146 @@ Lret:
     return result;
 }
 
-name_cache_ptr_t GetOrAddNameByKey(cache_t* cache, const char* name,
-                                   uint32_t entry_key)
+/// old slots moved to the new table per insert while resizing
+/// moving at least 2 drains the old table before the new one is half full
+#define NAME_SLOTS_MOVED_PER_INSERT 8
+
+static name_cache_ptr_t FindNameSlot(const cache_t* cache,
+                                     const name_slot_t* slots, uint32_t mask,
+                                     const char* name, size_t length,
+                                     uint32_t crc32)
 {
-	name_cache_ptr_t result = {0};
-    size_t length = (entry_key >> 16);
-    if (!length)
-        return result;
+    name_cache_ptr_t none = {0};
 
-    for(name_cache_node_t* currentBranch = cache->name_cache_root;
-        currentBranch;)
+    for(uint32_t slot = crc32 & mask;
+        slots[slot].name.v;
+        slot = (slot + 1) & mask)
     {
-        int cmp_result = entry_key - currentBranch->entry_key;
-        if (!cmp_result)
+        if (slots[slot].crc32 != crc32)
+            continue;
+
+        const char* cached_name = (slots[slot].name.v - 4)
+                                + cache->name_stringtable;
+        if (!memcmp(cached_name, name, length) && cached_name[length] == '\0')
+            return slots[slot].name;
+    }
+
+    return none;
+}
+
+static void InsertNameSlot(name_slot_t* slots, uint32_t mask,
+                           uint32_t crc32, name_cache_ptr_t name)
+{
+    uint32_t slot = crc32 & mask;
+    while(slots[slot].name.v)
+        slot = (slot + 1) & mask;
+
+    slots[slot].crc32 = crc32;
+    slots[slot].name = name;
+}
+
+static void MoveNameSlots(cache_t* cache, uint32_t count)
+{
+    const name_slot_t* old_slots = cache->old_name_slots;
+    uint32_t end = cache->old_name_slots_moved + count;
+    if (end > cache->old_name_slots_mask + 1)
+        end = cache->old_name_slots_mask + 1;
+
+    for(uint32_t i = cache->old_name_slots_moved; i < end; i++)
+    {
+        if (old_slots[i].name.v)
         {
-            const char* cached_name = (currentBranch->name_ptr.v - 4)
-                                    + cache->name_stringtable;
-            if ((cmp_result = memcmp(name, cached_name, length)) == 0)
-            {
-                return currentBranch->name_ptr;
-            }
+            InsertNameSlot(cache->name_slots, cache->name_slots_mask,
+                           old_slots[i].crc32, old_slots[i].name);
         }
-        // when we end up here we need to branch
-        {
-            name_cache_node_t* nextBranch = currentBranch +
-                                            ((cmp_result < 0)
-                                              ? currentBranch->left
-                                              : currentBranch->right);
-            if (nextBranch != currentBranch)
-            {
-                currentBranch = nextBranch;
-                continue;
-            }
+    }
+    cache->old_name_slots_moved = end;
 
-            // here we need to insert a new node
-            {
-                assert(cache->name_cache_node_size
-                       < cache->name_cache_node_capacity);
-                nextBranch = (cache->name_cache_node_size++
-                           + cache->name_cache_root);
-                if (cmp_result < 0)
-                {
-                    currentBranch->left = nextBranch - currentBranch;
-                }
-                else
-                {
-                    currentBranch->right = nextBranch - currentBranch;
-                }
+    if (end == cache->old_name_slots_mask + 1)
+    {
+        free(cache->old_name_slots);
+        cache->old_name_slots = 0;
+        cache->old_name_slots_mask = 0;
+        cache->old_name_slots_moved = 0;
+    }
+}
 
-                assert(cache->name_stringtable_size
-                       < cache->name_stringtable_capacity);
-                char* cached_name =
-                    cache->name_stringtable_size + cache->name_stringtable;
-                memcpy(cached_name, name, length);
-                *(cached_name + length) = '\0';
+static void ClearNameSlots(cache_t* cache)
+{
+    if (cache->old_name_slots)
+    {
+        free(cache->old_name_slots);
+        cache->old_name_slots = 0;
+        cache->old_name_slots_mask = 0;
+        cache->old_name_slots_moved = 0;
+    }
+    memset(cache->name_slots, 0,
+           (cache->name_slots_mask + 1) * sizeof(name_slot_t));
+    cache->name_count = 0;
+}
 
-                name_cache_ptr_t name_ptr = { cache->name_stringtable_size + 4 };
-                cache->name_stringtable_size += ALIGN4(length + 1);
+/// interns name whose crc32c is already known
+static name_cache_ptr_t GetOrAddNameCrc(cache_t* cache, const char* name,
+                                        size_t length, uint32_t crc32)
+{
+    name_cache_ptr_t result = {0};
+    if (!length)
+        return result;
 
-                nextBranch->entry_key = entry_key;
-                nextBranch->left = 0;
-                nextBranch->right = 0;
-                nextBranch->name_ptr = name_ptr;
+    result = FindNameSlot(cache, cache->name_slots, cache->name_slots_mask,
+                          name, length, crc32);
+    if (!result.v && cache->old_name_slots)
+    {
+        result = FindNameSlot(cache, cache->old_name_slots,
+                              cache->old_name_slots_mask,
+                              name, length, crc32);
+    }
+    if (result.v)
+        return result;
 
-                return nextBranch->name_ptr;
-            }
-        }
+    // twice the slots keeps the probe sequences short
+    if ((cache->name_count + 1) * 2 > cache->name_slots_mask + 1)
+    {
+        // finish a resize which could not keep up
+        if (cache->old_name_slots)
+            MoveNameSlots(cache, cache->old_name_slots_mask + 1);
+
+        uint32_t slots = (cache->name_slots_mask + 1) * 2;
+        name_slot_t* new_slots = (name_slot_t*)
+            calloc(slots, sizeof(name_slot_t));
+        assert(new_slots);
+
+        cache->old_name_slots = cache->name_slots;
+        cache->old_name_slots_mask = cache->name_slots_mask;
+        cache->old_name_slots_moved = 0;
+        cache->name_slots = new_slots;
+        cache->name_slots_mask = slots - 1;
     }
+    if (cache->old_name_slots)
+        MoveNameSlots(cache, NAME_SLOTS_MOVED_PER_INSERT);
+
+    GrowArena(cache->name_stringtable, &cache->name_stringtable_capacity,
+              CACHE_MAX_NAME_BYTES, 1,
+              cache->name_stringtable_size + ALIGN4(length + 1));
+    char* cached_name =
+        cache->name_stringtable_size + cache->name_stringtable;
+    memcpy(cached_name, name, length);
+    *(cached_name + length) = '\0';
+
+    result.v = cache->name_stringtable_size + 4;
+    cache->name_stringtable_size += ALIGN4(length + 1);
 
-    assert(0);
+    InsertNameSlot(cache->name_slots, cache->name_slots_mask, crc32, result);
+    cache->name_count++;
+
+    return result;
+}
+
+name_cache_ptr_t GetOrAddNameByKey(cache_t* cache, const char* name,
+                                   uint32_t entry_key)
+{
+    size_t length = (entry_key >> 16);
+    return GetOrAddNameCrc(cache, name, length, crc32c(~0, name, length));
 }
 
 name_cache_ptr_t GetOrAddNameLength(cache_t* cache, const char* name,
@@ -265,10 +1009,7 @@ name_cache_ptr_t GetOrAddNameLength(cache_t* cache, const char* name,
 {
     assert(length <= 0xFFFF);
 
-    uint32_t crcName = crc32c(~0, name, length);
-    uint32_t entry_key = ((crcName & 0xFFFF) | ((uint16_t)length) << 16);
-
-    return GetOrAddNameByKey(cache, name, entry_key);
+    return GetOrAddNameCrc(cache, name, length, crc32c(~0, name, length));
 }
 
 name_cache_ptr_t GetOrAddName(cache_t* cache, const char* name)
@@ -276,6 +1017,30 @@ name_cache_ptr_t GetOrAddName(cache_t* cache, const char* name)
     return GetOrAddNameLength(cache, name, strlen(name));
 }
 
+void FreeHandle(cache_t* cache, filehandle_ptr_t handle)
+{
+    const uint32_t length = HANDLE_LENGTH(handle.v);
+    if (handle.v == 1 || !length)
+        return;
+
+    const uint32_t ptr = handle.v & HANDLE_OFFSET_MASK;
+    const uint32_t crc32 =
+        crc32c(~0, cache->limbs + ptr, length * sizeof(uint32_t));
+    const uint32_t slot = HandleSlotOf(cache, crc32,
+                                       handle.v & ~HANDLE_OFFSET_MASK,
+                                       cache->limbs + ptr);
+    assert(cache->handle_slots[slot].handle.v == handle.v);
+    if (--cache->handle_slots[slot].refs)
+        return;
+
+    RemoveHandleSlot(cache, slot);
+    cache->handle_count--;
+
+    cache->limbs[ptr] = cache->free_limbs[length];
+    cache->free_limbs[length] = ptr + 1;
+    cache->dead_limbs += length;
+}
+
 meta_data_entry_t* CreateFileEntry(cache_t* cache, meta_data_entry_t* parentDir, const char* fName, uint32_t name_len)
 {
     const uint32_t entry_key = EntryKey(fName, name_len);
@@ -284,25 +1049,467 @@ meta_data_entry_t* CreateFileEntry(cache_t* cache, meta_data_entry_t* parentDir,
         CreateEntryInDirectoryByKey(cache, parentDir->cached_dir, fName, entry_key);
     assert(entry);
     entry->type = ENTRY_TYPE_FILE;
-    assert(cache->file_entries_capacity > cache->file_entries_size);
-    entry->cached_file = cache->file_entries + cache->file_entries_size++;
+    entry->cached_file = NewCachedFile(cache);
 
-    entry->cached_file->crc32 = 0;
-    entry->cached_file->data = 0;
-    entry->cached_file->size = 0;
+    return entry;
+}
+
+meta_data_entry_t* CreateSymlinkEntry(cache_t* cache, meta_data_entry_t* parentDir,
+                                      const char* fName, uint32_t name_len)
+{
+    meta_data_entry_t* entry = CreateFileEntry(cache, parentDir, fName, name_len);
+    entry->type = ENTRY_TYPE_SYMLINK;
 
     return entry;
 }
 
+void SetLinkTarget(cache_t* cache, meta_data_entry_t* link,
+                   const char* target, size_t target_length)
+{
+    assert(link->type == ENTRY_TYPE_SYMLINK);
+    cached_file_t* file = link->cached_file;
+
+    // many links share their target, think of lib*.so or node_modules
+    file->link_target = GetOrAddNameLength(cache, target, target_length);
+    file->link_ctime = file->attribs.ctime;
+}
+
+const char* LinkTarget(cache_t* cache, const meta_data_entry_t* link)
+{
+    assert(link->type == ENTRY_TYPE_SYMLINK);
+    const cached_file_t* file = link->cached_file;
+
+    if (!file->link_target.v
+     || file->link_ctime.seconds != file->attribs.ctime.seconds
+     || file->link_ctime.nseconds != file->attribs.ctime.nseconds)
+    {
+        return 0;
+    }
+
+    return toCharPtr(cache, file->link_target);
+}
+
+void InitNegativeCache(cache_t* cache, uint32_t capacity)
+{
+    uint32_t size = 0;
+    if (capacity)
+    {
+        for(size = 1; size < capacity; size <<= 1)
+            ;
+    }
+
+    free(cache->negative_entries);
+    cache->negative_entries = size ?
+        (negative_entry_t*) calloc(size, sizeof(negative_entry_t)) : 0;
+    cache->negative_capacity = size;
+}
+
+static negative_entry_t* NegativeSlot(const cache_t* cache, const cached_dir_t* parent,
+                                      uint32_t name_crc32)
+{
+    const uint32_t parent_idx = (uint32_t)(parent - cache->dir_entries);
+    const uint32_t hash = name_crc32 ^ (parent_idx * 0x9E3779B1);
+    return cache->negative_entries + (hash & (cache->negative_capacity - 1));
+}
+
+void AddNegativeEntry(cache_t* cache, const meta_data_entry_t* parentDir,
+                      const char* name, size_t name_length)
+{
+    if (!cache->negative_capacity || name_length > NEGATIVE_NAME_MAX)
+        return;
+
+    const uint32_t name_crc32 = crc32c(~0, name, name_length);
+    negative_entry_t* slot = NegativeSlot(cache, parentDir->cached_dir, name_crc32);
+
+    slot->parent = parentDir->cached_dir;
+    slot->parent_generation = parentDir->cached_dir->attribs.generation;
+    slot->parent_mtime = parentDir->cached_dir->attribs.mtime;
+    slot->name_crc32 = name_crc32;
+    slot->name_length = (uint8_t)name_length;
+    memcpy(slot->name, name, name_length);
+}
+
+int IsNegativeEntry(const cache_t* cache, const meta_data_entry_t* parentDir,
+                    const char* name, size_t name_length)
+{
+    if (!cache->negative_capacity || name_length > NEGATIVE_NAME_MAX)
+        return 0;
+
+    const cached_dir_t* parent = parentDir->cached_dir;
+    const uint32_t name_crc32 = crc32c(~0, name, name_length);
+    const negative_entry_t* slot = NegativeSlot(cache, parent, name_crc32);
+
+    return slot->parent == parent
+        && slot->parent_generation == parent->attribs.generation
+        && slot->name_crc32 == name_crc32
+        && slot->name_length == name_length
+        && slot->parent_mtime.seconds == parent->attribs.mtime.seconds
+        && slot->parent_mtime.nseconds == parent->attribs.mtime.nseconds
+        && !memcmp(slot->name, name, name_length);
+}
+
+void InitAccessCache(cache_t* cache, uint32_t capacity, uint32_t timeout)
+{
+    uint32_t size = 0;
+    if (capacity && timeout)
+    {
+        for(size = 1; size < capacity; size <<= 1)
+            ;
+    }
+
+    free(cache->access_entries);
+    cache->access_entries = size ?
+        (access_entry_t*) calloc(size, sizeof(access_entry_t)) : 0;
+    cache->access_capacity = size;
+    cache->access_timeout = timeout;
+}
+
+static access_entry_t* AccessSlot(const cache_t* cache, const cached_attribs_t* attribs,
+                                  uint32_t uid, uint32_t gid)
+{
+    uint32_t hash = (uint32_t)((uintptr_t)attribs / sizeof(cached_attribs_t));
+    hash = (hash ^ uid) * 0x9E3779B1;
+    hash = (hash ^ gid) * 0x9E3779B1;
+    return cache->access_entries + ((hash >> 8) & (cache->access_capacity - 1));
+}
+
+void AddAccess(cache_t* cache, const meta_data_entry_t* entry,
+               uint32_t uid, uint32_t gid, uint32_t granted, uint32_t now)
+{
+    const cached_attribs_t* attribs = EntryAttribs((meta_data_entry_t*)entry);
+    if (!cache->access_capacity || !attribs)
+        return;
+
+    access_entry_t* slot = AccessSlot(cache, attribs, uid, gid);
+
+    slot->attribs = attribs;
+    slot->generation = attribs->generation;
+    slot->uid = uid;
+    slot->gid = gid;
+    slot->mode = attribs->mode;
+    slot->owner_uid = attribs->uid;
+    slot->owner_gid = attribs->gid;
+    slot->fetched_at = now;
+    slot->granted = granted;
+}
+
+int LookupAccess(const cache_t* cache, const meta_data_entry_t* entry,
+                 uint32_t uid, uint32_t gid, uint32_t now, uint32_t* granted)
+{
+    const cached_attribs_t* attribs = EntryAttribs((meta_data_entry_t*)entry);
+    if (!cache->access_capacity || !attribs)
+        return 0;
+
+    const access_entry_t* slot = AccessSlot(cache, attribs, uid, gid);
+
+    // a chmod or chown drops what was granted before
+    if (slot->attribs != attribs
+     || slot->generation != attribs->generation
+     || slot->uid != uid || slot->gid != gid
+     || slot->mode != attribs->mode
+     || slot->owner_uid != attribs->uid
+     || slot->owner_gid != attribs->gid
+     || now - slot->fetched_at >= cache->access_timeout)
+    {
+        return 0;
+    }
+
+    *granted = slot->granted;
+    return 1;
+}
+
+static toc_entry_t* FindTocEntry(cache_t* cache, const meta_data_entry_t* entry)
+{
+    const char* path = toCharPtr(cache, entry->cached_dir->fullPath);
+    if (!path)
+        return 0;
+
+    const uint32_t path_length = (uint32_t)strlen(path);
+    const uint32_t mask = cache->toc_hash_mask;
+    uint32_t slot = TocHash(crc32c(~0, path, path_length), path_length) & mask;
+    for(uint32_t v = cache->toc_hash[slot];
+        v;
+        slot = (slot + 1) & mask, v = cache->toc_hash[slot])
+    {
+        toc_entry_t* toc_entry = cache->toc_entries + (v - 1);
+        if (toc_entry->entry == entry)
+            return toc_entry;
+    }
+
+    return 0;
+}
+
+/// the last toc entry takes the place of toc_entry
+static void RemoveTocEntry(cache_t* cache, toc_entry_t* toc_entry)
+{
+    const uint32_t index = (uint32_t)(toc_entry - cache->toc_entries);
+    const uint32_t last = cache->toc_size - 1;
+
+    RemoveTocSlot(cache, TocSlotOf(cache, index));
+    if (index != last)
+    {
+        cache->toc_hash[TocSlotOf(cache, last)] = index + 1;
+        *toc_entry = cache->toc_entries[last];
+    }
+
+    cache->toc_size = last;
+}
+
+/// drops the toc entries of dir and all directories below it
+static void RemoveFromToc(cache_t* cache, meta_data_entry_t* dir)
+{
+    assert(dir->type == ENTRY_TYPE_DIRECTORY);
+
+    for(uint32_t i = 0; i < dir->cached_dir->entries_size; i++)
+    {
+        meta_data_entry_t* child = DirEntry(dir->cached_dir, i);
+        if (child->type == ENTRY_TYPE_DIRECTORY)
+            RemoveFromToc(cache, child);
+    }
+
+    toc_entry_t* toc_entry = FindTocEntry(cache, dir);
+    if (toc_entry)
+        RemoveTocEntry(cache, toc_entry);
+}
+
+uint32_t DirEntryPosition(const cached_dir_t* dir, const meta_data_entry_t* entry)
+{
+    for(uint32_t extent = 0;
+        extent < DIR_MAX_EXTENTS && dir->extents[extent];
+        extent++)
+    {
+        const uint32_t start = DirExtentStart(extent);
+        const uint32_t size = extent ? start : DIR_FIRST_EXTENT;
+        if (entry >= dir->extents[extent] && entry < dir->extents[extent] + size)
+            return start + (uint32_t)(entry - dir->extents[extent]);
+    }
+
+    assert(!"entry is not in dir");
+    return ~0u;
+}
+
+static uint32_t NameBytes(cache_t* cache, name_cache_ptr_t name)
+{
+    return name.v ? ALIGN4(strlen(toCharPtr(cache, name)) + 1) : 0;
+}
+
+/// gives back what entry owns, everything below it for a directory
+static void FreeEntry(cache_t* cache, meta_data_entry_t* entry)
+{
+    FreeHandle(cache, entry->handle);
+    cache->dead_name_bytes += NameBytes(cache, entry->name);
+
+    switch (entry->type)
+    {
+        case ENTRY_TYPE_DIRECTORY:
+        {
+            cached_dir_t* dir = entry->cached_dir;
+            for(uint32_t i = 0; i < dir->entries_size; i++)
+                FreeEntry(cache, DirEntry(dir, i));
+
+            for(uint32_t extent = 0;
+                extent < DIR_MAX_EXTENTS && dir->extents[extent];
+                extent++)
+            {
+                PushFree(&cache->free_extents[extent], dir->extents[extent],
+                         ENTRY_TYPE_NONE);
+            }
+            free(dir->entry_keys);
+            free(dir->index);
+
+            cache->dead_name_bytes += NameBytes(cache, dir->fullPath);
+            PushFree(&cache->free_dirs, dir, ENTRY_TYPE_DIRECTORY);
+        }
+        break;
+        case ENTRY_TYPE_FILE:
+        case ENTRY_TYPE_SYMLINK:
+        {
+            cached_file_t* file = entry->cached_file;
+            free(file->data);
+            free(file->blocks);
+            free(file->dirty);
+
+            cache->dead_name_bytes += NameBytes(cache, file->link_target);
+            PushFree(&cache->free_files, file, (entry_type_t)entry->type);
+        }
+        break;
+        default: break;
+    }
+}
+
+void RemoveEntry(cache_t* cache, cached_dir_t* parentDir, meta_data_entry_t* entry)
+{
+    const uint32_t position = DirEntryPosition(parentDir, entry);
+    assert(position < parentDir->entries_size);
+
+    if (entry->type == ENTRY_TYPE_DIRECTORY)
+        RemoveFromToc(cache, entry);
+    FreeEntry(cache, entry);
+
+    const uint32_t last_position = parentDir->entries_size - 1;
+    meta_data_entry_t* last = DirEntry(parentDir, last_position);
+    if (parentDir->index)
+    {
+        RemoveDirIndexSlot(parentDir, DirIndexSlotOf(parentDir, position));
+        if (position != last_position)
+            parentDir->index[DirIndexSlotOf(parentDir, last_position)] = position + 1;
+    }
+
+    if (entry != last)
+    {
+        *entry = *last;
+        parentDir->entry_keys[position] = last->entry_key;
+        // the toc points at the entry, not at its cached_dir
+        if (entry->type == ENTRY_TYPE_DIRECTORY)
+        {
+            toc_entry_t* toc_entry = FindTocEntry(cache, last);
+            if (toc_entry)
+                toc_entry->entry = entry;
+        }
+    }
+
+    parentDir->entries_size--;
+}
+
+int CacheWantsCompaction(const cache_t* cache)
+{
+    // below a MiB of garbage there is not much to win
+    return (cache->dead_name_bytes > (1 << 20)
+         && cache->dead_name_bytes > cache->name_stringtable_size / 2)
+        || (cache->dead_limbs > (1 << 18)
+         && cache->dead_limbs > cache->limbs_size / 2);
+}
+
+static name_cache_ptr_t MoveName(cache_t* cache, name_cache_ptr_t name,
+                                 const char* old_names)
+{
+    if (!name.v)
+        return name;
+
+    const char* str = old_names + (name.v - 4);
+    return GetOrAddNameLength(cache, str, strlen(str));
+}
+
+/// entries which shared a handle share it again afterwards and
+/// handles stored before their prefix was learned get it now
+static filehandle_ptr_t MoveHandle(cache_t* cache, filehandle_ptr_t handle,
+                                   const uint32_t* old_limbs)
+{
+    if (handle.v == 1)
+        return handle;
+
+    fhandle3 full_handle;
+    DecodeHandle(cache, handle.v, old_limbs, &full_handle);
+    return handleToPtr(cache, &full_handle);
+}
+
+static void CompactEntry(cache_t* cache, meta_data_entry_t* entry,
+                         const char* old_names, const uint32_t* old_limbs)
+{
+    entry->name = MoveName(cache, entry->name, old_names);
+    entry->handle = MoveHandle(cache, entry->handle, old_limbs);
+
+    switch (entry->type)
+    {
+        case ENTRY_TYPE_DIRECTORY:
+        {
+            cached_dir_t* dir = entry->cached_dir;
+            dir->fullPath = MoveName(cache, dir->fullPath, old_names);
+            for(uint32_t i = 0; i < dir->entries_size; i++)
+                CompactEntry(cache, DirEntry(dir, i), old_names, old_limbs);
+        }
+        break;
+        case ENTRY_TYPE_FILE:
+        case ENTRY_TYPE_SYMLINK:
+            entry->cached_file->link_target =
+                MoveName(cache, entry->cached_file->link_target, old_names);
+        break;
+        default: break;
+    }
+}
+
+void CompactCache(cache_t* cache)
+{
+    // what is alive is a good guess for what the new arenas need
+    // dead_name_bytes counts shared names more than once
+    const uint32_t names_capacity =
+        (cache->name_stringtable_size > cache->dead_name_bytes)
+        ? cache->name_stringtable_size - cache->dead_name_bytes : 1;
+    const uint32_t limbs_capacity =
+        cache->limbs_size - cache->dead_limbs + 1;
+
+    char* names = (char*) ReserveArena(CACHE_MAX_NAME_BYTES, 1, names_capacity);
+    uint32_t* limbs = (uint32_t*) ReserveArena(
+        CACHE_MAX_LIMBS, sizeof(uint32_t), limbs_capacity);
+    if (!names || !limbs)
+    {
+        if (names)
+            ReleaseArena(names, CACHE_MAX_NAME_BYTES, 1);
+        if (limbs)
+            ReleaseArena(limbs, CACHE_MAX_LIMBS, sizeof(uint32_t));
+        return;
+    }
+
+    char* old_names = cache->name_stringtable;
+    uint32_t* old_limbs = cache->limbs;
+
+    cache->name_stringtable = names;
+    cache->name_stringtable_size = 0;
+    cache->name_stringtable_capacity = names_capacity;
+    ClearNameSlots(cache);
+    cache->dead_name_bytes = 0;
+
+    cache->limbs = limbs;
+    cache->limbs_size = 0;
+    cache->limbs_capacity = limbs_capacity;
+    memset(cache->free_limbs, 0, sizeof(cache->free_limbs));
+    cache->dead_limbs = 0;
+    ClearHandleSlots(cache);
+
+    CompactEntry(cache, cache->root, old_names, old_limbs);
+    for(uint32_t i = 0; i < cache->toc_size; i++)
+    {
+        cache->toc_entries[i].relative_name_pointer =
+            cache->toc_entries[i].entry->cached_dir->fullPath;
+    }
+
+    ReleaseArena(old_names, CACHE_MAX_NAME_BYTES, 1);
+    ReleaseArena(old_limbs, CACHE_MAX_LIMBS, sizeof(uint32_t));
+}
+
+void InitCacheCrc32c(void)
+{
+    crc32c_init();
+}
+
 void ResetCache(cache_t* cache)
 {
     cache->toc_size = 0;
-    cache->metadata_size = 0;
-    cache->name_cache_root->entry_key = 0x7fff;
-    cache->name_cache_root->left = 0;
-    cache->name_cache_root->right = 0;
+    memset(cache->toc_hash, 0,
+           (cache->toc_hash_mask + 1) * sizeof(uint32_t));
+    // slot 0 is the root entry
+    cache->metadata_size = 1;
+    ClearNameSlots(cache);
     cache->name_stringtable_size = 0;
-    cache->name_cache_node_size = 1;
+    cache->dead_name_bytes = 0;
+    // the root handle lives in rootHandle, no other one is left
+    cache->limbs_size = 0;
+    memset(cache->free_limbs, 0, sizeof(cache->free_limbs));
+    cache->dead_limbs = 0;
+    ClearHandleSlots(cache);
+    // the extents were carved from the metadata reset above
+    memset(cache->free_extents, 0, sizeof(cache->free_extents));
+    // negative and access entries point at entries which are gone
+    if (cache->negative_capacity)
+    {
+        memset(cache->negative_entries, 0,
+               cache->negative_capacity * sizeof(negative_entry_t));
+    }
+    if (cache->access_capacity)
+    {
+        memset(cache->access_entries, 0,
+               cache->access_capacity * sizeof(access_entry_t));
+    }
 }
 
 meta_data_entry_t* LookupInDirectoryByKey(cache_t* cache, cached_dir_t* lookupDir,
@@ -312,23 +1519,43 @@ meta_data_entry_t* LookupInDirectoryByKey(cache_t* cache, cached_dir_t* lookupDi
 
     const size_t name_length = (entry_key >> 16);
 
-    meta_data_entry_t const * one_past_last_entry =
-        lookupDir->entries + lookupDir->entries_size;
+    if (!lookupDir->index && lookupDir->entries_size >= DIR_INDEX_MIN_ENTRIES)
+        BuildDirIndex(lookupDir);
 
-    for(meta_data_entry_t* entry = lookupDir->entries;
-        entry < one_past_last_entry;
-        entry++)
+    if (lookupDir->index)
     {
-        if (entry_key == entry->entry_key)
+        const uint32_t mask = lookupDir->index_mask;
+        uint32_t slot = DirIndexHash(entry_key) & mask;
+        for(uint32_t v = lookupDir->index[slot];
+            v;
+            slot = (slot + 1) & mask, v = lookupDir->index[slot])
         {
-            const char* entry_name =
-                cache->name_stringtable + (entry->name.v - 4);
-            if (!memcmp(name, entry_name, name_length))
+            if (entry_key == lookupDir->entry_keys[v - 1])
             {
-                result = entry;
-                break;
+                meta_data_entry_t* entry = DirEntry(lookupDir, v - 1);
+                const char* entry_name =
+                    cache->name_stringtable + (entry->name.v - 4);
+                if (!memcmp(name, entry_name, name_length))
+                    return entry;
             }
         }
+
+        return 0;
+    }
+
+    const uint32_t entries_size = lookupDir->entries_size;
+    for(uint32_t i = FindEntryKey(lookupDir->entry_keys, 0, entries_size, entry_key);
+        i < entries_size;
+        i = FindEntryKey(lookupDir->entry_keys, i + 1, entries_size, entry_key))
+    {
+        meta_data_entry_t* entry = DirEntry(lookupDir, i);
+        const char* entry_name =
+            cache->name_stringtable + (entry->name.v - 4);
+        if (!memcmp(name, entry_name, name_length))
+        {
+            result = entry;
+            break;
+        }
     }
 
     return result;
@@ -362,18 +1589,27 @@ toc_entry_t* GetOrCreateTocEntryForDir(cache_t* cache, cached_dir_t* parentDir,
     size_t name_length = strlen(name);
     memcpy(fullPathBuffer + parentPathLength + 1, name, name_length);
 
-    const uint32_t full_path_key = EntryKey(fullPathBuffer, name_length + parentPathLength + 1);
+    const uint32_t full_path_length = (uint32_t)(name_length + parentPathLength + 1);
+    const uint32_t full_path_crc32 = crc32c(~0, fullPathBuffer, full_path_length);
+    const uint32_t full_path_key = (full_path_crc32 & 0xFFFF)
+                                 | (full_path_length << 16);
 
     name_cache_ptr_t fullPathPtr =
-        GetOrAddNameByKey(cache, fullPathBuffer, full_path_key);
+        GetOrAddNameCrc(cache, fullPathBuffer, full_path_length, full_path_crc32);
     entry->cached_dir->fullPath = fullPathPtr;
 
-    assert(cache->toc_capacity > cache->toc_size);
+    GrowArena(cache->toc_entries, &cache->toc_capacity, CACHE_MAX_TOC,
+              sizeof(toc_entry_t), cache->toc_size + 1);
+    // twice the slots keeps the probe sequences short
+    if ((cache->toc_size + 1) * 2 > cache->toc_hash_mask + 1)
+        GrowTocHash(cache);
     toc_entry_t* toc_entry = cache->toc_entries + cache->toc_size++;
 
     toc_entry->entry_key = full_path_key;
     toc_entry->relative_name_pointer = fullPathPtr;
+    toc_entry->path_crc32 = full_path_crc32;
     toc_entry->entry = entry;
+    InsertTocSlot(cache, (uint32_t)(toc_entry - cache->toc_entries));
 
     return toc_entry;
 }
@@ -388,13 +1624,47 @@ meta_data_entry_t* LookupInDirectory(cache_t* cache, cached_dir_t* lookupDir,
     return LookupInDirectoryByKey(cache, lookupDir, name, entry_key);
 }
 
-void allocate_dir_entires(cache_t* cache, cached_dir_t* dir, int n)
+/// adds the next extent to dir, carved from the metadata arena
+static void GrowDirEntries(cache_t* cache, cached_dir_t* dir)
+{
+    const uint32_t extent = DirExtentOf(dir->entries_capacity);
+    assert(extent < DIR_MAX_EXTENTS);
+    const uint32_t n = extent ? DirExtentStart(extent) : DIR_FIRST_EXTENT;
+
+    meta_data_entry_t* entries =
+        (meta_data_entry_t*) PopFree(&cache->free_extents[extent]);
+    if (entries)
+    {
+        memset(entries, 0, n * sizeof(meta_data_entry_t));
+    }
+    else
+    {
+        GrowArena(cache->root, &cache->metadata_capacity, CACHE_MAX_METADATA,
+                  sizeof(meta_data_entry_t), cache->metadata_size + n);
+        entries = cache->root + cache->metadata_size;
+        cache->metadata_size += n;
+    }
+    dir->extents[extent] = entries;
+
+    dir->entries_capacity += n;
+    dir->entry_keys = (uint32_t*) realloc(dir->entry_keys,
+        dir->entries_capacity * sizeof(uint32_t));
+}
+
+/// Returns: a new entry at the end of dir with only its key set
+static meta_data_entry_t* AppendDirEntry(cache_t* cache, cached_dir_t* dir,
+                                         uint32_t entry_key)
 {
-    assert(cache->metadata_size + n < cache->metadata_capacity);
-    meta_data_entry_t*  entires = cache->root + cache->metadata_size;
-    cache->metadata_size += n;
-    dir->entries = entires;
-    dir->entries_capacity = n;
+    if (dir->entries_size == dir->entries_capacity)
+        GrowDirEntries(cache, dir);
+
+    const uint32_t position = dir->entries_size++;
+    meta_data_entry_t* result = DirEntry(dir, position);
+    result->entry_key = entry_key;
+    dir->entry_keys[position] = entry_key;
+    IndexLastEntry(dir);
+
+    return result;
 }
 
 meta_data_entry_t* GetOrCreateSubdirectoryByKey(cache_t* cache, cached_dir_t* parentDir,
@@ -414,27 +1684,14 @@ meta_data_entry_t* GetOrCreateSubdirectoryByKey(cache_t* cache, cached_dir_t* pa
         goto Lret;
     }
 
-    if (parentDir->entries_capacity == 0)
-    {
-        // allocate 256 direntires for now
-        allocate_dir_entires(cache, parentDir, 256);
-    }
-
-    assert(parentDir->entries_size < parentDir->entries_capacity);
-    result = parentDir->entries + parentDir->entries_size++;
-
-    assert(cache->dir_entries_capacity > cache->dir_entries_size);
-    result->cached_dir = cache->dir_entries + cache->dir_entries_size++;
+    result = AppendDirEntry(cache, parentDir, entry_key);
 
-    result->cached_dir->entries = 0;
-    result->cached_dir->entries_capacity = 0;
-    result->cached_dir->entries_size = 0;
-    result->cached_dir->fullPath.v = 0;
+    result->cached_dir = NewCachedDir(cache);
 
-    result->entry_key = entry_key;
     result->name = GetOrAddNameByKey(cache, directory_name, entry_key);
 
     result->type = ENTRY_TYPE_DIRECTORY;
+    result->flags = ENTRY_FLAG_NONE;
     GetOrCreateTocEntryForDir(cache, parentDir, result);
 Lret:
     return result;
@@ -468,13 +1725,13 @@ lookup_parent_result_t LookupParent(cache_t* cache, const char* full_path, uint3
     const char* last_component_ptr = full_path + (slash_position + 1);
 
     size_t dir_path_size = path_length - (last_component_length + 1);
-    const uint32_t dir_entry_key = EntryKey(full_path, dir_path_size);
+    const uint32_t dir_crc32 = crc32c(~0, full_path, dir_path_size);
 
     meta_data_entry_t* parentDir = cache->root;
     if (dir_path_size > 1)
     {
         parentDir =
-            LookupDirPathByKey(cache, full_path, dir_entry_key);
+            LookupDirPathByKey(cache, full_path, dir_path_size, dir_crc32);
     }
 
     result.parentDir = parentDir;
@@ -565,23 +1822,374 @@ meta_data_entry_t* CreateEntryInDirectoryByKey(cache_t* cache, cached_dir_t* par
         goto Lret;
     }
 
-    if (parentDir->entries_capacity == 0)
-    {
-        // allocate 256 direntires for now
-        allocate_dir_entires(cache, parentDir, 256);
-    }
     // when we get here we can create our entry
-
-    assert(parentDir->entries_capacity > parentDir->entries_size);
-    result = parentDir->entries + parentDir->entries_size++;
-    result->entry_key = entry_key;
+    result = AppendDirEntry(cache, parentDir, entry_key);
     result->name = GetOrAddNameByKey(cache, name, entry_key);
+    result->flags = ENTRY_FLAG_NONE;
 
 Lret:
     return result;
 }
 
 
+static void ReserveFileData(cached_file_t* file, uint32_t size)
+{
+    if (size <= file->data_capacity)
+        return;
+
+    const uint32_t old_blocks = FILE_BLOCK_COUNT(file->data_capacity);
+    const uint32_t new_blocks = FILE_BLOCK_COUNT(size);
+
+    file->data = realloc(file->data, size);
+    file->data_capacity = size;
+
+    if (new_blocks != old_blocks)
+    {
+        file->blocks = (file_block_t*)
+            realloc(file->blocks, new_blocks * sizeof(file_block_t));
+        memset(file->blocks + old_blocks, 0,
+               (new_blocks - old_blocks) * sizeof(file_block_t));
+    }
+}
+
+static void MixBlockCrcs(cached_file_t* file)
+{
+    uint32_t crc = ~0;
+    // the size may be ahead of the data we hold
+    const uint32_t known_size = (file->size < file->data_capacity)
+                              ? file->size : file->data_capacity;
+    const uint32_t n_blocks = FILE_BLOCK_COUNT(known_size);
+
+    for(uint32_t i = 0; i < n_blocks; i++)
+    {
+        crc = crc32c(crc, &file->blocks[i].crc32, sizeof(uint32_t));
+    }
+
+    file->crc32 = crc;
+}
+
+/// records that [begin, end) of the block now holds known content
+/// range_crc may be passed if the crc of that range is already known
+static void UpdateBlock(cached_file_t* file, uint32_t block_idx,
+                        uint32_t begin, uint32_t end, const uint32_t* range_crc)
+{
+    file_block_t* block = file->blocks + block_idx;
+    const uint32_t block_start = block_idx << FILE_BLOCK_SHIFT;
+    const uint32_t block_begin = begin - block_start;
+    const uint32_t block_end = end - block_start;
+
+    // we only track a prefix of known bytes per block
+    if (block_begin > block->valid_size)
+        return;
+
+    if (block_begin == 0 && block_end >= block->valid_size)
+    {
+        block->crc32 = range_crc ? *range_crc
+                                 : crc32c(~0, (uint8_t*)file->data + begin, end - begin);
+        block->valid_size = block_end;
+    }
+    else
+    {
+        if (block_end > block->valid_size)
+            block->valid_size = block_end;
+
+        block->crc32 = crc32c(~0, (uint8_t*)file->data + block_start,
+                              block->valid_size);
+    }
+}
+
+void FillFileBlocks(cached_file_t* file, const void* content,
+                    uint32_t content_size, uint32_t offset)
+{
+    const uint32_t end = offset + content_size;
+    ReserveFileData(file, end);
+    memcpy((uint8_t*)file->data + offset, content, content_size);
+
+    for(uint32_t begin = offset; begin < end;)
+    {
+        const uint32_t block_idx = begin >> FILE_BLOCK_SHIFT;
+        uint32_t range_end = (block_idx + 1) << FILE_BLOCK_SHIFT;
+        if (range_end > end)
+            range_end = end;
+
+        UpdateBlock(file, block_idx, begin, range_end, 0);
+        begin = range_end;
+    }
+
+    if (end > file->size)
+        file->size = end;
+
+    MixBlockCrcs(file);
+}
+
+int32_t ReadFileBlocks(const cached_file_t* file, void* content,
+                       uint32_t size, uint32_t offset)
+{
+    if (offset >= file->size)
+        return 0;
+
+    uint32_t end = offset + size;
+    if (end > file->size || end < offset)
+        end = file->size;
+
+    if (end > file->data_capacity)
+        return -1;
+
+    for(uint32_t begin = offset; begin < end;)
+    {
+        const uint32_t block_idx = begin >> FILE_BLOCK_SHIFT;
+        const uint32_t block_start = block_idx << FILE_BLOCK_SHIFT;
+        uint32_t range_end = block_start + FILE_BLOCK_SIZE;
+        if (range_end > end)
+            range_end = end;
+
+        if (block_start + file->blocks[block_idx].valid_size < range_end)
+            return -1;
+
+        begin = range_end;
+    }
+
+    memcpy(content, (const uint8_t*)file->data + offset, end - offset);
+
+    return (int32_t)(end - offset);
+}
+
+uint32_t WriteFileBlocks(cached_file_t* file, const void* content,
+                         uint32_t content_size, uint32_t offset,
+                         file_range_t* changed, uint32_t max_changed)
+{
+    uint32_t n_changed = 0;
+    const uint32_t end = offset + content_size;
+    ReserveFileData(file, end);
+
+    for(uint32_t begin = offset; begin < end;)
+    {
+        const uint32_t block_idx = begin >> FILE_BLOCK_SHIFT;
+        const uint32_t block_start = block_idx << FILE_BLOCK_SHIFT;
+        uint32_t range_end = block_start + FILE_BLOCK_SIZE;
+        if (range_end > end)
+            range_end = end;
+
+        const uint32_t length = range_end - begin;
+        const uint8_t* src = (const uint8_t*)content + (begin - offset);
+        uint8_t* dst = (uint8_t*)file->data + begin;
+        const file_block_t block = file->blocks[block_idx];
+        const uint32_t range_crc = crc32c(~0, src, length);
+
+        int unchanged = 0;
+        if (begin == block_start && length == block.valid_size)
+        {
+            // the whole known block is rewritten, a different crc means
+            // it changed, an equal one still has to match the cached bytes
+            unchanged = (range_crc == block.crc32) && !memcmp(src, dst, length);
+        }
+        else if (range_end - block_start <= block.valid_size)
+        {
+            // we have to touch the cached bytes anyway, so compare them exactly
+            unchanged = !memcmp(src, dst, length);
+        }
+
+        if (!unchanged)
+        {
+            memcpy(dst, src, length);
+            UpdateBlock(file, block_idx, begin, range_end, &range_crc);
+
+            if (changed && max_changed)
+            {
+                file_range_t* last = n_changed ? changed + (n_changed - 1) : 0;
+                if (last && last->offset + last->size == begin)
+                {
+                    last->size += length;
+                }
+                else if (n_changed < max_changed)
+                {
+                    changed[n_changed].offset = begin;
+                    changed[n_changed].size = length;
+                    n_changed++;
+                }
+                else
+                {
+                    // out of ranges, widen the last one to cover this one as well
+                    last->size = range_end - last->offset;
+                }
+            }
+        }
+
+        begin = range_end;
+    }
+
+    if (end > file->size)
+        file->size = end;
+
+    MixBlockCrcs(file);
+
+    return n_changed;
+}
+
+int AddDirtyRange(cached_file_t* file, uint32_t offset, uint32_t size)
+{
+    uint32_t begin = offset;
+    uint32_t end = offset + size;
+
+    for(uint32_t i = file->n_dirty; i-- > 0;)
+    {
+        const file_range_t range = file->dirty[i];
+        if (begin <= range.offset + range.size && end >= range.offset)
+        {
+            if (range.offset < begin)
+                begin = range.offset;
+            if (range.offset + range.size > end)
+                end = range.offset + range.size;
+            file->dirty[i] = file->dirty[--file->n_dirty];
+        }
+    }
+
+    if (file->n_dirty == FILE_MAX_DIRTY_RANGES)
+        return 0;
+
+    if (!file->dirty)
+    {
+        file->dirty = (file_range_t*)
+            malloc(FILE_MAX_DIRTY_RANGES * sizeof(file_range_t));
+    }
+
+    file->dirty[file->n_dirty].offset = begin;
+    file->dirty[file->n_dirty].size = end - begin;
+    file->n_dirty++;
+
+    return 1;
+}
+
+void ClearDirtyRanges(cached_file_t* file)
+{
+    free(file->dirty);
+    file->dirty = 0;
+    file->n_dirty = 0;
+}
+
+void InvalidateFileBlocks(cached_file_t* file)
+{
+    if (file->blocks)
+    {
+        memset(file->blocks, 0,
+               FILE_BLOCK_COUNT(file->data_capacity) * sizeof(file_block_t));
+    }
+    MixBlockCrcs(file);
+}
+
+cached_attribs_t* EntryAttribs(meta_data_entry_t* entry)
+{
+    cached_attribs_t* result = 0;
+
+    if ((entry->type == ENTRY_TYPE_FILE || entry->type == ENTRY_TYPE_SYMLINK)
+     && entry->cached_file)
+    {
+        result = &entry->cached_file->attribs;
+    }
+    else if (entry->type == ENTRY_TYPE_DIRECTORY && entry->cached_dir)
+        result = &entry->cached_dir->attribs;
+
+    return result;
+}
+
+int UpdateAttribs(cache_t* cache, meta_data_entry_t* entry,
+                  const fattr3* attribs, uint32_t now)
+{
+    cached_attribs_t* cached = EntryAttribs(entry);
+    if (!cached)
+        return 0;
+
+    const int isDir = (entry->type == ENTRY_TYPE_DIRECTORY);
+    const uint32_t min = isDir ? cache->acdirmin : cache->acregmin;
+    const uint32_t max = isDir ? cache->acdirmax : cache->acregmax;
+
+    const int changed = cached->fetched_at
+        && (cached->size != attribs->size
+         || cached->mtime.seconds != attribs->mtime.seconds
+         || cached->mtime.nseconds != attribs->mtime.nseconds
+         || cached->ctime.seconds != attribs->ctime.seconds
+         || cached->ctime.nseconds != attribs->ctime.nseconds);
+
+    // files which changed recently are likely to change again soon
+    uint32_t timeout = min;
+    if (!changed && now > attribs->mtime.seconds)
+    {
+        timeout = (now - attribs->mtime.seconds) / 10;
+        if (timeout < min)
+            timeout = min;
+        if (timeout > max)
+            timeout = max;
+    }
+
+    cached->mode = attribs->mode;
+    cached->uid = attribs->uid;
+    cached->gid = attribs->gid;
+    cached->nlink = attribs->nlink;
+    cached->size = attribs->size;
+    cached->mtime = attribs->mtime;
+    cached->ctime = attribs->ctime;
+    cached->fetched_at = now;
+    cached->timeout = timeout;
+
+    return changed;
+}
+
+int AttribsValid(const cached_attribs_t* attribs, uint32_t now)
+{
+    return attribs->fetched_at
+        && (now - attribs->fetched_at) < attribs->timeout;
+}
+
+static int NfsTimeBefore(nfstime3 a, nfstime3 b)
+{
+    return a.seconds < b.seconds
+        || (a.seconds == b.seconds && a.nseconds < b.nseconds);
+}
+
+int ApplyPostOpAttribs(cache_t* cache, meta_data_entry_t* entry,
+                       const fattr3* attribs, uint32_t now)
+{
+    cached_attribs_t* cached = EntryAttribs(entry);
+    if (!cached || attribs->type == NF3NON)
+        return 0;
+
+    // replies on different connections can overtake each other
+    if (cached->fetched_at && NfsTimeBefore(attribs->ctime, cached->ctime))
+        return 0;
+
+    return UpdateAttribs(cache, entry, attribs, now);
+}
+
+int ApplyWcc(cache_t* cache, meta_data_entry_t* entry,
+             const wcc_data* wcc, uint32_t now)
+{
+    cached_attribs_t* cached = EntryAttribs(entry);
+    if (!cached)
+        return 0;
+
+    int foreign = 0;
+    if (cached->fetched_at && wcc->has_before)
+    {
+        foreign = cached->size != wcc->before.size
+               || cached->mtime.seconds != wcc->before.mtime.seconds
+               || cached->mtime.nseconds != wcc->before.mtime.nseconds
+               || cached->ctime.seconds != wcc->before.ctime.seconds
+               || cached->ctime.nseconds != wcc->before.ctime.nseconds;
+    }
+
+    if (wcc->has_after)
+    {
+        ApplyPostOpAttribs(cache, entry, &wcc->after, now);
+    }
+    else
+    {
+        // nothing to go on, the next stat asks the server
+        cached->fetched_at = 0;
+    }
+
+    return foreign;
+}
+
 /// Adds or updates a file
 meta_data_entry_t* AddFile(cache_t* cache, const char* full_path,
                            const void* content, uint32_t content_size, int virtual_file)
@@ -595,13 +2203,7 @@ meta_data_entry_t* AddFile(cache_t* cache, const char* full_path,
     {
         result = CreateEntryFromFullPath(cache, full_path, path_length);
         result->type = ENTRY_TYPE_FILE;
-        assert(cache->dir_entries_capacity > cache->dir_entries_size);
-        result->cached_file =
-            (cached_file_t*)cache->dir_entries + cache->dir_entries_size++;
-
-        result->cached_file->crc32 = 0;
-        result->cached_file->size = 0;
-        result->cached_file->data = 0;
+        result->cached_file = NewCachedFile(cache);
 
         if (virtual_file)
             result->flags |= ENTRY_FLAG_VIRTUAL;
@@ -613,20 +2215,9 @@ meta_data_entry_t* AddFile(cache_t* cache, const char* full_path,
 
     if (content)
     {
-        uint32_t content_crc = crc32c(~0, content, content_size);
-        if (content_size == file->size && content_crc == file->crc32)
-        {
-            // puts("size and crc match .. not updating content\n");
-        }
-        else
-        {
-            if (content_size != file->size)
-                file->data = realloc(file->data, content_size);
-
-            memcpy(file->data, content, content_size);
-            file->crc32 = content_crc;
-            file->size = content_size;
-        }
+        // blocks which match the cached ones are not copied
+        file->size = content_size;
+        WriteFileBlocks(file, content, content_size, 0, 0, 0);
     }
 
     return result;
@@ -653,24 +2244,9 @@ meta_data_entry_t* UpdateFile(cache_t* cache, const char* full_path,
     
     if (content)
     {
-        uint32_t content_crc = crc32c(~0, content, content_size);
-        
-        size_t at_least = content_size + offset;
-        
-        if (file->size >= at_least)
-        {
-            uint32_t file_portion_crc = 
-                crc32c(~0, file->data + offset, content_size);
-            if (content_crc == file_portion_crc)
-                goto Lret;
-        }
-        if (at_least > file->size)
-            file->data = realloc(file->data, at_least);
-
-        memcpy(file->data + offset, content, content_size);
-        file->crc32 = crc32c(~0, file->data, at_least);        
+        WriteFileBlocks(file, content, content_size, offset, 0, 0);
     }
-Lret:
+
     return result;
 }
 
@@ -691,56 +2267,304 @@ void PrintNameCache(cache_t* cache)
     }
 }
 
-int main(int argc, char** argv)
+/// Returns: a handle of n_limbs limbs
+static fhandle3 TestHandle(uint32_t n_limbs, const uint32_t* limbs)
 {
-    uint32_t initial_name_storage_capacity = 8192;
-    uint32_t initial_name_nodes_capacity = 256;
-    uint32_t initial_metadata_nodes = 512;
-    uint32_t initial_dir_nodes = 256;
-    uint32_t initial_toc_capacity = 256;
+    fhandle3 result = {{0}};
+    memcpy(result.handle, limbs, n_limbs * sizeof(uint32_t));
+    result.length = n_limbs * sizeof(uint32_t);
+    return result;
+}
+
+/// Returns: the refs of the slot holding handle, 0 if it has none
+static uint32_t HandleRefs(const cache_t* cache, filehandle_ptr_t handle)
+{
+    const uint32_t ptr = handle.v & HANDLE_OFFSET_MASK;
+    const uint32_t length = HANDLE_LENGTH(handle.v);
+    const uint32_t crc32 =
+        crc32c(~0, cache->limbs + ptr, length * sizeof(uint32_t));
+    const handle_slot_t* slot = cache->handle_slots
+        + HandleSlotOf(cache, crc32, handle.v & ~HANDLE_OFFSET_MASK,
+                       cache->limbs + ptr);
+    return (slot->handle.v == handle.v) ? slot->refs : 0;
+}
+
+static meta_data_entry_t* TestFile(cache_t* cache, meta_data_entry_t* dir,
+                                   const char* name, const fhandle3* handle)
+{
+    meta_data_entry_t* entry = CreateFileEntry(cache, dir, name, strlen(name));
+    entry->handle = handleToPtr(cache, handle);
+    return entry;
+}
+
+/// entries with the same handle share one slot and its limbs,
+/// the limbs of a handle nobody uses go to the next one of that length
+static void TestSharedHandles(cache_t* cache)
+{
+    meta_data_entry_t* dir =
+        GetOrCreateSubdirectory(cache, cache->root->cached_dir, "shared", strlen("shared"));
+
+    const uint32_t first_limbs[] = { 0x1001, 0x1002, 0x1003, 0x1004 };
+    const uint32_t second_limbs[] = { 0x2001, 0x2002, 0x2003, 0x2004 };
+    const fhandle3 first = TestHandle(4, first_limbs);
+    const fhandle3 second = TestHandle(4, second_limbs);
+
+    const uint32_t handle_count = cache->handle_count;
+    meta_data_entry_t* a = TestFile(cache, dir, "a", &first);
+    meta_data_entry_t* b = TestFile(cache, dir, "b", &first);
+    meta_data_entry_t* c = TestFile(cache, dir, "c", &first);
+    const filehandle_ptr_t shared = a->handle;
+    const uint32_t limbs_size = cache->limbs_size;
+
+    assert(b->handle.v == shared.v && c->handle.v == shared.v);
+    assert(cache->handle_count == handle_count + 1);
+    assert(HandleRefs(cache, shared) == 3);
+
+    fhandle3 decoded = ptrToHandle(cache, shared);
+    assert(!memcmp(&decoded, &first, sizeof(fhandle3)));
+
+    RemoveEntry(cache, dir->cached_dir, LookupInDirectory(cache, dir->cached_dir, "a", 1));
+    assert(HandleRefs(cache, shared) == 2);
+    RemoveEntry(cache, dir->cached_dir, LookupInDirectory(cache, dir->cached_dir, "b", 1));
+    assert(HandleRefs(cache, shared) == 1);
+    decoded = ptrToHandle(cache, LookupInDirectory(cache, dir->cached_dir, "c", 1)->handle);
+    assert(!memcmp(&decoded, &first, sizeof(fhandle3)));
+
+    RemoveEntry(cache, dir->cached_dir, LookupInDirectory(cache, dir->cached_dir, "c", 1));
+    assert(cache->handle_count == handle_count);
+    assert(cache->dead_limbs == HANDLE_LENGTH(shared.v));
+
+    // the freed limbs are taken again instead of growing the arena
+    meta_data_entry_t* d = TestFile(cache, dir, "d", &second);
+    assert((d->handle.v & HANDLE_OFFSET_MASK) == (shared.v & HANDLE_OFFSET_MASK));
+    assert(cache->limbs_size == limbs_size);
+    assert(cache->dead_limbs == 0);
+    assert(HandleRefs(cache, d->handle) == 1);
+    decoded = ptrToHandle(cache, d->handle);
+    assert(!memcmp(&decoded, &second, sizeof(fhandle3)));
+
+    printf("shared handles: ok\n");
+}
+
+/// handles of families which only share their first 3 limbs within a
+/// family, unlike knfsd the prefix has no fsid layout to go by, the
+/// first handles come from more small families than there are prefix
+/// slots, the slots still go to the 7 large ones seen after them
+static void TestHandlePrefixes(cache_t* cache)
+{
+    meta_data_entry_t* dir =
+        GetOrCreateSubdirectory(cache, cache->root->cached_dir, "prefixed", strlen("prefixed"));
+
+    enum { small_families = HANDLE_MAX_CANDIDATES, small_size = 2,
+           families = HANDLE_MAX_PREFIXES, batch = 4, per_family = 4 };
+    char name[32];
+
+    for(uint32_t f = 0; f < small_families; f++)
+    {
+        for(uint32_t i = 0; i < small_size; i++)
+        {
+            const uint32_t limbs[] = {
+                0xE0000000 | (f + 1), 0xD00D0000 | f, 0xF00D, i + 1
+            };
+            const fhandle3 handle = TestHandle(4, limbs);
+            snprintf(name, sizeof(name), "s%u_%u", f, i);
+            const meta_data_entry_t* entry = TestFile(cache, dir, name, &handle);
+            const fhandle3 decoded = ptrToHandle(cache, entry->handle);
+            assert(!memcmp(&decoded, &handle, sizeof(fhandle3)));
+        }
+    }
+    assert(cache->handle_prefix_count == 0);
+
+    // directories are listed one after the other, so members of a
+    // family come in runs
+    for(uint32_t i = 0; cache->handle_samples < HANDLE_PREFIX_SAMPLES; i++)
+    {
+        const uint32_t f = (i / batch) % families;
+        const uint32_t limbs[] = {
+            0xF0000000 | (f + 1), 0xBEEF0000 | f, 0xCAFE, i + 1, (f << 8) | 1
+        };
+        const fhandle3 handle = TestHandle(5, limbs);
+        snprintf(name, sizeof(name), "w%u", i);
+        const meta_data_entry_t* entry = TestFile(cache, dir, name, &handle);
+        const fhandle3 decoded = ptrToHandle(cache, entry->handle);
+        assert(!memcmp(&decoded, &handle, sizeof(fhandle3)));
+        assert(HANDLE_PREFIX(entry->handle.v) == 0);
+    }
+    assert(cache->handle_prefix_count == HANDLE_MAX_PREFIXES);
+
+    uint32_t used = 0;
+    for(uint32_t f = 0; f < families + 1; f++)
+    {
+        for(uint32_t i = 0; i < per_family; i++)
+        {
+            // the last family is one of the small ones
+            const uint32_t limbs[] = {
+                0xF0000000 | (f + 1), 0xBEEF0000 | f, 0xCAFE, 0x10000 + i, 7
+            };
+            const uint32_t small_limbs[] = {
+                0xE0000000 | 1, 0xD00D0000, 0xF00D, 0x10000 + i
+            };
+            const fhandle3 handle = (f < families)
+                ? TestHandle(5, limbs) : TestHandle(4, small_limbs);
+            snprintf(name, sizeof(name), "f%u_%u", f, i);
+            const meta_data_entry_t* entry = TestFile(cache, dir, name, &handle);
+            const fhandle3 decoded = ptrToHandle(cache, entry->handle);
+            assert(!memcmp(&decoded, &handle, sizeof(fhandle3)));
+
+            const uint32_t prefix = HANDLE_PREFIX(entry->handle.v);
+            assert((prefix != 0) == (f < families));
+            if (prefix)
+            {
+                assert(cache->handle_prefixes[prefix - 1].length == 3);
+                used |= 1u << prefix;
+            }
+        }
+    }
+    // each large family has its own prefix
+    assert(used == ((1u << (HANDLE_MAX_PREFIXES + 1)) - 2));
 
-    uint8_t* cache_memory = (uint8_t*) malloc(
-        sizeof(cache_t) + initial_name_storage_capacity
-                        + (initial_name_nodes_capacity *
-                            sizeof(name_cache_node_t)));
+    printf("handle prefixes: ok\n");
+}
+
+/// handles keep the length the server sent, with 0 limbs inside,
+/// a length which isn't a multiple of 4 or the full NFS3_FHSIZE
+static void TestHandleLengths(cache_t* cache)
+{
+    meta_data_entry_t* dir =
+        GetOrCreateSubdirectory(cache, cache->root->cached_dir, "lengths", strlen("lengths"));
+
+    enum { n_handles = 4 };
+    fhandle3 handles[n_handles];
+    const uint32_t zeros[] = { 0x4001, 0, 0, 0x4004 };
+    handles[0] = TestHandle(4, zeros);
+
+    uint32_t full[HANDLE_MAX_LIMBS];
+    for(uint32_t i = 0; i < HANDLE_MAX_LIMBS; i++)
+        full[i] = 0x5000 + i;
+    handles[1] = TestHandle(HANDLE_MAX_LIMBS, full);
+
+    // the same bytes, once 5 long and once padded with 0 to 8
+    const uint32_t odd[] = { 0x6001, 0x65 };
+    handles[2] = TestHandle(2, odd);
+    handles[2].length = 5;
+    handles[3] = TestHandle(2, odd);
+
+    meta_data_entry_t* entries[n_handles];
+    for(uint32_t i = 0; i < n_handles; i++)
+    {
+        char name[16];
+        snprintf(name, sizeof(name), "l%u", i);
+        entries[i] = TestFile(cache, dir, name, &handles[i]);
+    }
+
+    assert(entries[2]->handle.v != entries[3]->handle.v);
+    for(uint32_t i = 0; i < n_handles; i++)
+    {
+        const fhandle3 decoded = ptrToHandle(cache, entries[i]->handle);
+        assert(!memcmp(&decoded, &handles[i], sizeof(fhandle3)));
+    }
 
-    toc_entry_t* toc_mem = (toc_entry_t*) calloc(
-        initial_toc_capacity, sizeof(toc_entry_t));
+    printf("handle lengths: ok\n");
+}
+
+/// a directory growing over several extents keeps every entry
+/// where lookups and DirEntry find it, also after removals
+static void TestLargeDirectory(cache_t* cache)
+{
+    meta_data_entry_t* dir =
+        GetOrCreateSubdirectory(cache, cache->root->cached_dir, "large", strlen("large"));
+
+    enum { n_entries = 1000 };
+    char name[16];
+    for(uint32_t i = 0; i < n_entries; i++)
+    {
+        snprintf(name, sizeof(name), "e%u", i);
+        CreateFileEntry(cache, dir, name, strlen(name));
+    }
+
+    cached_dir_t* cached_dir = dir->cached_dir;
+    assert(cached_dir->entries_size == n_entries);
+    for(uint32_t i = 0; i < n_entries; i++)
+    {
+        snprintf(name, sizeof(name), "e%u", i);
+        meta_data_entry_t* entry =
+            LookupInDirectory(cache, cached_dir, name, strlen(name));
+        assert(entry && !strcmp(toCharPtr(cache, entry->name), name));
+        assert(DirEntry(cached_dir, DirEntryPosition(cached_dir, entry)) == entry);
+    }
 
-    name_cache_node_t* tree_mem = (name_cache_node_t*)
-                                (cache_memory + sizeof(cache_t)
-                                + initial_name_storage_capacity);
+    // every third goes, the last entries move into the holes
+    for(uint32_t i = 0; i < n_entries; i += 3)
+    {
+        snprintf(name, sizeof(name), "e%u", i);
+        RemoveEntry(cache, cached_dir,
+                    LookupInDirectory(cache, cached_dir, name, strlen(name)));
+    }
+    assert(cached_dir->entries_size == n_entries - (n_entries + 2) / 3);
+    for(uint32_t i = 0; i < n_entries; i++)
+    {
+        snprintf(name, sizeof(name), "e%u", i);
+        meta_data_entry_t* entry =
+            LookupInDirectory(cache, cached_dir, name, strlen(name));
+        assert((i % 3 == 0) ? !entry
+             : (entry && !strcmp(toCharPtr(cache, entry->name), name)));
+    }
 
-    meta_data_entry_t* meta_mem = (meta_data_entry_t*) calloc(
-        initial_metadata_nodes , sizeof(meta_data_entry_t));
+    printf("large directory: ok\n");
+}
 
-    cached_dir_t* dirs_mem = (cached_dir_t*)calloc(
-        initial_dir_nodes, sizeof(cached_dir_t));
+int main(int argc, char** argv)
+{
+    uint32_t initial_name_storage_capacity = 8192;
+    uint32_t initial_name_slots = 512;
+    uint32_t initial_metadata_nodes = 512;
+    uint32_t initial_dir_nodes = 256;
+    uint32_t initial_toc_capacity = 256;
+    uint32_t initial_file_nodes = 256;
+    uint32_t initial_limb_capacity = 1024;
 
     cache_t cache = {
-        .toc_entries = toc_mem,
-        .root = meta_mem++,
+        .toc_entries = (toc_entry_t*) ReserveArena(
+            CACHE_MAX_TOC, sizeof(toc_entry_t), initial_toc_capacity),
+        .root = (meta_data_entry_t*) ReserveArena(
+            CACHE_MAX_METADATA, sizeof(meta_data_entry_t), initial_metadata_nodes),
 
         .toc_size = 0,
         .toc_capacity = initial_toc_capacity,
+        .toc_hash = (uint32_t*) calloc(initial_toc_capacity * 2, sizeof(uint32_t)),
+        .toc_hash_mask = initial_toc_capacity * 2 - 1,
 
         .metadata_size = 1,
         .metadata_capacity = initial_metadata_nodes,
 
-        .name_stringtable  = (char*)(cache_memory + sizeof(cache_t)),
+        .name_stringtable  = (char*) ReserveArena(
+            CACHE_MAX_NAME_BYTES, 1, initial_name_storage_capacity),
         .name_stringtable_size = 0,
         .name_stringtable_capacity = initial_name_storage_capacity,
 
-        .name_cache_root = tree_mem,
-        .name_cache_node_size = 1,
-        .name_cache_node_capacity = initial_name_nodes_capacity,
+        .name_slots = (name_slot_t*) calloc(initial_name_slots, sizeof(name_slot_t)),
+        .name_slots_mask = initial_name_slots - 1,
 
-        .dir_entries = dirs_mem,
+        .handle_slots = (handle_slot_t*) calloc(64, sizeof(handle_slot_t)),
+        .handle_slots_mask = 63,
+
+        .dir_entries = (cached_dir_t*) ReserveArena(
+            CACHE_MAX_DIRS, sizeof(cached_dir_t), initial_dir_nodes),
         .dir_entries_size = 0,
-        .dir_entries_capacity = initial_dir_nodes
+        .dir_entries_capacity = initial_dir_nodes,
+
+        .file_entries = (cached_file_t*) ReserveArena(
+            CACHE_MAX_FILES, sizeof(cached_file_t), initial_file_nodes),
+        .file_entries_size = 0,
+        .file_entries_capacity = initial_file_nodes,
+
+        .limbs = (uint32_t*) ReserveArena(
+            CACHE_MAX_LIMBS, sizeof(uint32_t), initial_limb_capacity),
+        .limbs_size = 0,
+        .limbs_capacity = initial_limb_capacity
     };
 
-    cache.root->cached_dir = dirs_mem++;
+    cache.root->cached_dir = NewCachedDir(&cache);
     cache.root->cached_dir->fullPath = GetOrAddName(&cache, "/");
     assert(cache.root->cached_dir->fullPath.v != 0);
 
@@ -759,6 +2583,11 @@ int main(int argc, char** argv)
     name_cache_ptr_t w2 = GetOrAddName(&cache, "William");
     printf("W2 NameCachePtr: %u\n", w2.v);
 
+    TestSharedHandles(&cache);
+    TestHandlePrefixes(&cache);
+    TestHandleLengths(&cache);
+    TestLargeDirectory(&cache);
+
     printf("\n\n\t sizeof(cache_t): %d\n", sizeof(cache_t));
 
     return 0;
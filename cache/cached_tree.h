@@ -11,6 +11,10 @@
 #  include "crc32.c"
 #  include <assert.h>
 
+#ifdef _MSC_VER
+#  include <intrin.h>
+#endif
+
 struct cached_file_t;
 struct cached_dir_t;
 
@@ -19,19 +23,50 @@ typedef struct name_cache_ptr_t
     uint32_t v;
 } name_cache_ptr_t;
 
+/// bits 0-21 are the offset of the limbs in cache_t.limbs, 22-26 the
+/// number of limbs, 27-28 how many bytes the handle is short of its
+/// last limb and 29-31 the handle_prefix_t + 1 they follow, 0 for
+/// none, 1 stands for the root handle
 typedef struct filehandle_ptr_t
 {
     uint32_t v;
 } filehandle_ptr_t;
 
-typedef struct name_cache_node_t
+#define HANDLE_OFFSET_BITS 22
+#define HANDLE_OFFSET_MASK ((1u << HANDLE_OFFSET_BITS) - 1)
+#define HANDLE_LENGTH(V) (((V) >> HANDLE_OFFSET_BITS) & 31)
+#define HANDLE_PADDING(V) (((V) >> (HANDLE_OFFSET_BITS + 5)) & 3)
+#define HANDLE_PREFIX(V) ((V) >> (HANDLE_OFFSET_BITS + 7))
+#define HANDLE_MAX_PREFIXES 7
+#define HANDLE_MAX_LIMBS (NFS3_FHSIZE / 4)
+/// candidates compete for the prefix slots while the first handles
+/// are sampled, the least used one makes room for a new one
+#define HANDLE_MAX_CANDIDATES 16
+#define HANDLE_PREFIX_SAMPLES 1024
+
+/// leading limbs many handles share, like the fsid and export
+/// fields which servers put in front of the file id
+typedef struct handle_prefix_t
 {
-    uint32_t entry_key;
-    int32_t left;
-    int32_t right;
+    uint32_t length; /// in limbs
+    uint32_t hits; /// handles which started with it
+    uint32_t limbs[HANDLE_MAX_LIMBS];
+} handle_prefix_t;
 
-    name_cache_ptr_t name_ptr;
-} name_cache_node_t;
+/// slot of the name interning table, name.v == 0 marks a free slot
+typedef struct name_slot_t
+{
+    uint32_t crc32;
+    name_cache_ptr_t name;
+} name_slot_t;
+
+/// slot of the handle interning table, handle.v == 0 marks a free slot
+typedef struct handle_slot_t
+{
+    uint32_t crc32; /// of the stored limbs
+    filehandle_ptr_t handle;
+    uint32_t refs; /// entries using handle, its limbs are freed at 0
+} handle_slot_t;
 
 /// metadata which doesn't change often
 typedef struct meta_data_entry_t
@@ -56,42 +91,117 @@ typedef struct meta_data_entry_t
     filehandle_ptr_t handle;
 } meta_data_entry_t;
 
+/// attributes as the server reported them
+typedef struct cached_attribs_t
+{
+    uint32_t mode;
+    uint32_t uid;
+    uint32_t gid;
+    uint32_t nlink;
+    uint64_t size;
+    nfstime3 mtime;
+    nfstime3 ctime;
+
+    uint32_t fetched_at; /// local time in seconds, 0 if never fetched
+    uint32_t timeout; /// seconds after fetched_at the attributes are trusted
+
+    /// bumped whenever the slot holding these attributes is reused,
+    /// caches which point at them tell an old owner from a new one
+    uint32_t generation;
+} cached_attribs_t;
+
+#define FILE_BLOCK_SHIFT 16
+#define FILE_BLOCK_SIZE (1 << FILE_BLOCK_SHIFT)
+#define FILE_BLOCK_COUNT(SIZE) \
+    (((SIZE) + (FILE_BLOCK_SIZE - 1)) >> FILE_BLOCK_SHIFT)
+
+/// bookkeeping for FILE_BLOCK_SIZE bytes of cached file data
+typedef struct file_block_t
+{
+    uint32_t crc32; /// crc32c of the first valid_size bytes of the block
+    uint32_t valid_size; /// how many bytes from the start of the block are known
+} file_block_t;
+
+typedef struct file_range_t
+{
+    uint32_t offset;
+    uint32_t size;
+} file_range_t;
+
+#define FILE_MAX_DIRTY_RANGES 8
+
 /// contains cached data which is likely to change
 typedef struct cached_file_t
 {
-    uint32_t crc32; /// crc32_hash of the cached file
+    uint32_t crc32; /// crc32c over the crc32s of all blocks
     uint32_t mtime; /// remote mtime at point of caching
     uint32_t size; /// size of the cached data
-    uint32_t padding; ///currently meaningless for files
+    uint32_t data_capacity; /// how many bytes are allocated for data
 
     void* data;
+    file_block_t* blocks; /// one per FILE_BLOCK_SIZE bytes of data_capacity
+
+    cached_attribs_t attribs;
+
+    /// written locally but not yet on the server, allocated on demand
+    file_range_t* dirty;
+    uint32_t n_dirty;
+
+    /// symlinks only, 0 until READLINK answered
+    name_cache_ptr_t link_target;
+    nfstime3 link_ctime; /// ctime of the link when the target was read
 } cached_file_t;
 
+#define DIR_FIRST_EXTENT_SHIFT 4
+#define DIR_FIRST_EXTENT (1 << DIR_FIRST_EXTENT_SHIFT)
+/// enough for DIR_FIRST_EXTENT << (DIR_MAX_EXTENTS - 1) entries
+#define DIR_MAX_EXTENTS 24
+
 /// contains cached data which is likely to change
 typedef struct cached_dir_t
 {
     uint32_t crc32; /// mixed_file_hashes of all the content
-    uint32_t mtime; /// remote mtime at point of caching
     uint32_t entries_size; /// how many entires the directory has
-    uint32_t entries_capacity; /// how many entries are allocated in the entries array
-
-    meta_data_entry_t* entries;
+    uint32_t entries_capacity; /// how many entries the extents hold
+
+    /// the entries, extent 0 and 1 hold DIR_FIRST_EXTENT entries each
+    /// and every further one twice as many as the one before
+    /// extents never move, use DirEntry to get at position i
+    meta_data_entry_t* extents[DIR_MAX_EXTENTS];
+    /// the entry_key of each entry again, scans read 16 keys per cache
+    /// line from here and only touch entries whose key matches
+    uint32_t* entry_keys;
+
+    /// open addressing over the entry_keys of entries, a slot holds
+    /// the position of its entry + 1, 0 if free
+    /// built by the first lookup which sees DIR_INDEX_MIN_ENTRIES entries
+    uint32_t* index;
+    uint32_t index_mask; /// slots - 1
 
     name_cache_ptr_t fullPath;
+
+    cached_attribs_t attribs;
 } cached_dir_t;
 
+/// smaller directories are scanned, with the keys apart from the
+/// entries that is as fast as hashing
+#define DIR_INDEX_MIN_ENTRIES 128
+
 typedef enum entry_type_t {
     ENTRY_TYPE_NONE,
     ENTRY_TYPE_FILE,
     ENTRY_TYPE_DIRECTORY,
+    ENTRY_TYPE_SYMLINK, /// uses cached_file for its attributes and target
     ENTRY_TYPE_MAX,
 } entry_type_t;
 
 typedef enum entry_flag_t {
     ENTRY_FLAG_NONE,
     ENTRY_FLAG_VIRTUAL = (1 << 0),
+    ENTRY_FLAG_UNLISTED = (1 << 1), /// directory whose entries have not been read yet
+    ENTRY_FLAG_LISTED = (1 << 2), /// seen by the listing of its directory in progress
 
-    ENTRY_FLAG_MAX = (1 << 1),
+    ENTRY_FLAG_MAX = (1 << 3),
 } entry_flag_t;
 
 
@@ -106,10 +216,42 @@ typedef struct toc_entry_t
         uint32_t entry_key;
     };
     name_cache_ptr_t relative_name_pointer;
+    uint32_t path_crc32; /// crc32c of the full path, keys the toc hash
 
     meta_data_entry_t* entry;
 } toc_entry_t;
 
+#define NEGATIVE_NAME_MAX 47
+
+/// a name the server reported missing from a directory
+/// valid as long as the directory keeps the mtime it had back then
+typedef struct negative_entry_t
+{
+    const cached_dir_t* parent; /// 0 for a free slot
+    uint32_t parent_generation;
+    nfstime3 parent_mtime;
+    uint32_t name_crc32;
+    uint8_t name_length;
+    char name[NEGATIVE_NAME_MAX];
+} negative_entry_t;
+
+/// what the server granted a uid/gid on an entry
+/// valid for access_timeout seconds as long as the entry keeps the
+/// mode and owner it had back then
+typedef struct access_entry_t
+{
+    const cached_attribs_t* attribs; /// 0 for a free slot
+    uint32_t generation;
+    uint32_t uid;
+    uint32_t gid;
+    uint32_t mode;
+    uint32_t owner_uid;
+    uint32_t owner_gid;
+    uint32_t fetched_at;
+    uint32_t granted;
+} access_entry_t;
+
+/// what a slot on one of the free lists of cache_t holds
 typedef struct freelist_entry_t
 {
     entry_type_t entry_type;
@@ -117,6 +259,23 @@ typedef struct freelist_entry_t
     struct freelist_entry_t* next;
 } freelist_entry_t;
 
+/// how far the arenas of cache_t may grow, only address space is
+/// reserved for that up front, memory gets committed as they fill up
+#if UINTPTR_MAX > 0xFFFFFFFFu
+#  define CACHE_MAX_NAME_BYTES (1u << 31) /// name_cache_ptr_t is an offset
+#  define CACHE_MAX_METADATA   (1u << 28)
+#  define CACHE_MAX_DIRS       (1u << 24)
+#  define CACHE_MAX_FILES      (1u << 27)
+#  define CACHE_MAX_LIMBS      (1u << HANDLE_OFFSET_BITS)
+#else
+#  define CACHE_MAX_NAME_BYTES (1u << 26)
+#  define CACHE_MAX_METADATA   (1u << 22)
+#  define CACHE_MAX_DIRS       (1u << 17)
+#  define CACHE_MAX_FILES      (1u << 20)
+#  define CACHE_MAX_LIMBS      (1u << 22)
+#endif
+#define CACHE_MAX_TOC CACHE_MAX_DIRS
+
 typedef struct cache_t
 {
     toc_entry_t* toc_entries;
@@ -125,6 +284,11 @@ typedef struct cache_t
     uint32_t toc_size;
     uint32_t toc_capacity;
 
+    /// open addressing over path_crc32 and path_length of the toc
+    /// entries, a slot holds the index of its toc entry + 1, 0 if free
+    uint32_t* toc_hash;
+    uint32_t toc_hash_mask; /// slots - 1, at least twice toc_capacity
+
     uint32_t metadata_size;
     uint32_t metadata_capacity;
 
@@ -132,11 +296,15 @@ typedef struct cache_t
     uint32_t name_stringtable_size;
     uint32_t name_stringtable_capacity;
 
-    /// the root has the virtual value of 7fff
-    /// which means whenever we get hash is to 7fff we store it here
-    name_cache_node_t* name_cache_root;
-    uint32_t name_cache_node_size;
-    uint32_t name_cache_node_capacity;
+    /// interned names, open addressing on the crc32c of the name
+    /// on growth the slots of the old table move over a few per insert
+    /// and lookups check both until it is drained
+    name_slot_t* name_slots;
+    uint32_t name_slots_mask;
+    uint32_t name_count;
+    name_slot_t* old_name_slots; /// 0 unless a resize is in progress
+    uint32_t old_name_slots_mask;
+    uint32_t old_name_slots_moved;
 
     cached_dir_t* dir_entries;
     uint32_t dir_entries_size;
@@ -150,9 +318,62 @@ typedef struct cache_t
     uint32_t limbs_size;
     uint32_t limbs_capacity;
 
+    /// every handle is stored once, entries with the same handle share
+    /// its limbs, open addressing on the crc32c of the limbs
+    handle_slot_t* handle_slots;
+    uint32_t handle_slots_mask;
+    uint32_t handle_count;
+
+    /// learned by handleToPtr and never changed afterwards since
+    /// handles point to them, the most used candidates of the first
+    /// HANDLE_PREFIX_SAMPLES handles take the slots, a free slot is
+    /// taken by the next prefix found after that
+    handle_prefix_t handle_prefixes[HANDLE_MAX_PREFIXES];
+    uint32_t handle_prefix_count;
+    handle_prefix_t handle_candidates[HANDLE_MAX_CANDIDATES];
+    uint32_t handle_candidate_count;
+    uint32_t handle_samples;
+    /// the last handle which had no prefix, the next such handle
+    /// may have one in common with it
+    fhandle3 unmatched_handle;
+
     fhandle3 rootHandle;
-    
-    freelist_entry_t* freelist;
+
+    /// attribute timeouts in seconds, the timeout of an entry grows
+    /// with the time since its last change, like acregmin/acregmax
+    /// and acdirmin/acdirmax of the kernel nfs client
+    uint32_t acregmin;
+    uint32_t acregmax;
+    uint32_t acdirmin;
+    uint32_t acdirmax;
+
+    /// what FSINFO reported, listings grow their pages up to these
+    uint32_t dtpref;
+    uint32_t rtmax;
+    /// and writes are split into pieces of at most this size
+    uint32_t wtmax;
+
+    /// direct mapped, a new miss replaces whatever was in its slot
+    negative_entry_t* negative_entries;
+    uint32_t negative_capacity; /// a power of two, 0 disables the cache
+
+    /// direct mapped as well
+    access_entry_t* access_entries;
+    uint32_t access_capacity; /// a power of two, 0 disables the cache
+    uint32_t access_timeout;
+
+    /// slots RemoveEntry gave back, they hold the freelist_entry_t
+    /// which links them
+    freelist_entry_t* free_dirs;
+    freelist_entry_t* free_files;
+    freelist_entry_t* free_extents[DIR_MAX_EXTENTS];
+    /// freed runs of handle limbs by length, the offset + 1 of the
+    /// first run, whose first limb holds the offset + 1 of the next
+    uint32_t free_limbs[HANDLE_MAX_LIMBS + 1];
+
+    /// what the free lists can't reuse, CompactCache gets it back
+    uint32_t dead_name_bytes; /// an estimate, names are shared
+    uint32_t dead_limbs;
 } cache_t;
 
 typedef struct lookup_parent_result_t
@@ -190,11 +411,90 @@ meta_data_entry_t* CreateEntryInDirectoryByKey(cache_t* cache, cached_dir_t* par
                                                
 meta_data_entry_t* CreateFileEntry(cache_t* cache, meta_data_entry_t* parentDir,
                                    const char* fName, uint32_t name_len);
+
+meta_data_entry_t* CreateSymlinkEntry(cache_t* cache, meta_data_entry_t* parentDir,
+                                      const char* fName, uint32_t name_len);
+
+/// Stores the target READLINK returned for link
+/// it stays valid until the ctime of the link changes
+void SetLinkTarget(cache_t* cache, meta_data_entry_t* link,
+                   const char* target, size_t target_length);
+
+/// Returns: the cached target of link or 0 if it has to be read again
+const char* LinkTarget(cache_t* cache, const meta_data_entry_t* link);
+
+/// Sizes the negative lookup cache, rounded up to a power of two
+/// 0 disables it
+void InitNegativeCache(cache_t* cache, uint32_t capacity);
+
+/// Remembers that name does not exist in parentDir
+void AddNegativeEntry(cache_t* cache, const meta_data_entry_t* parentDir,
+                      const char* name, size_t name_length);
+
+/// Returns: 1 if name is known not to exist in parentDir
+int IsNegativeEntry(const cache_t* cache, const meta_data_entry_t* parentDir,
+                    const char* name, size_t name_length);
+
+/// Sizes the access cache, rounded up to a power of two
+/// a timeout of 0 disables it
+void InitAccessCache(cache_t* cache, uint32_t capacity, uint32_t timeout);
+
+/// Remembers the ACCESS3_* bits the server granted uid/gid on entry
+void AddAccess(cache_t* cache, const meta_data_entry_t* entry,
+               uint32_t uid, uint32_t gid, uint32_t granted, uint32_t now);
+
+/// Returns: 1 and the granted ACCESS3_* bits in *granted if they are cached
+int LookupAccess(const cache_t* cache, const meta_data_entry_t* entry,
+                 uint32_t uid, uint32_t gid, uint32_t now, uint32_t* granted);
+
+/// reserves address space for max_count elements and commits the
+/// first count of them, zeroed
+/// Returns: the base of the arena or 0
+void* ReserveArena(uint32_t max_count, size_t element_size, uint32_t count);
+
+/// commits more of an arena from ReserveArena until it holds needed
+/// elements, at least doubling *capacity, nothing in it moves
+/// aborts if needed is beyond max_count or the memory can't be committed
+void GrowArena(void* base, uint32_t* capacity, uint32_t max_count,
+               size_t element_size, uint32_t needed);
+
+/// Returns: a zeroed cached_dir_t / cached_file_t from the free
+///          lists or the arenas
+cached_dir_t* NewCachedDir(cache_t* cache);
+cached_file_t* NewCachedFile(cache_t* cache);
+
+/// drops a reference handleToPtr returned, the limbs are given
+/// back once no entry uses the handle anymore
+void FreeHandle(cache_t* cache, filehandle_ptr_t handle);
+
+/// Returns: 1 if enough of the names or limbs is dead for
+///          CompactCache to be worth it
+int CacheWantsCompaction(const cache_t* cache);
+
+/// copies the live names and handle limbs into fresh arenas and
+/// releases the old ones, every name_cache_ptr_t, filehandle_ptr_t
+/// and char* from toCharPtr changes, nothing may hold on to them
+void CompactCache(cache_t* cache);
+
+/// Removes entry from parentDir, a directory goes with everything below it
+/// the last entry of parentDir moves into the freed slot
+/// unused handle limbs, cached_dir_t, cached_file_t and extents go to
+/// the free lists for the next entries, names stay dead until CompactCache
+void RemoveEntry(cache_t* cache, cached_dir_t* parentDir, meta_data_entry_t* entry);
+
+/// Returns: the position of entry in dir
+uint32_t DirEntryPosition(const cached_dir_t* dir, const meta_data_entry_t* entry);
                                    
 const char* toCharPtr(cache_t* cache, name_cache_ptr_t ptr);
 
 void ResetCache(cache_t* cache);
 
+/// runs crc32c_init for the copy in cached_tree.c, InitCache calls it
+/// before any thread hashes names or handles
+void InitCacheCrc32c(void);
+
+/// Returns: the stored copy of handle with one more reference,
+///          FreeHandle drops it again
 filehandle_ptr_t handleToPtr(cache_t* cache, const fhandle3* handle);
 fhandle3 ptrToHandle(cache_t* cache, filehandle_ptr_t fh_ptr);
 
@@ -206,6 +506,57 @@ meta_data_entry_t* AddFile(cache_t* cache, const char* full_path,
 meta_data_entry_t* UpdateFile(cache_t* cache, const char* full_path,
                               const void* content, uint32_t content_size, uint32_t offset,
                               int virtual_file);
+
+/// Stores content which was read from the server
+void FillFileBlocks(cached_file_t* file, const void* content,
+                    uint32_t content_size, uint32_t offset);
+
+/// Copies [offset, offset + size) out of the cached content,
+/// clamped to the size of the file
+/// Returns: the bytes copied or -1 if part of the range isn't cached
+int32_t ReadFileBlocks(const cached_file_t* file, void* content,
+                       uint32_t size, uint32_t offset);
+
+/// Applies a write to the cached content
+/// Returns: how many ranges of the write differ from the cached blocks
+///          the ranges are coalesced and written into changed
+uint32_t WriteFileBlocks(cached_file_t* file, const void* content,
+                         uint32_t content_size, uint32_t offset,
+                         file_range_t* changed, uint32_t max_changed);
+
+/// Remembers that [offset, offset + size) has to be written back,
+/// overlapping and adjacent ranges are merged
+/// Returns: 0 if FILE_MAX_DIRTY_RANGES are taken already
+int AddDirtyRange(cached_file_t* file, uint32_t offset, uint32_t size);
+
+/// Forgets the dirty ranges, they made it to the server
+void ClearDirtyRanges(cached_file_t* file);
+
+/// Forgets the cached content, the file changed on the server
+void InvalidateFileBlocks(cached_file_t* file);
+
+/// Returns: the attributes of a file or directory entry, 0 for others
+cached_attribs_t* EntryAttribs(meta_data_entry_t* entry);
+
+/// Stores attributes fetched at now and picks their timeout
+/// Returns: 1 if they differ from the cached ones
+int UpdateAttribs(cache_t* cache, meta_data_entry_t* entry,
+                  const fattr3* attribs, uint32_t now);
+
+/// Returns: 1 if the attributes can be used without asking the server
+int AttribsValid(const cached_attribs_t* attribs, uint32_t now);
+
+/// Stores attributes which came along with another reply
+/// attributes older than the cached ones are ignored
+/// Returns: 1 if the entry changed since it was cached
+int ApplyPostOpAttribs(cache_t* cache, meta_data_entry_t* entry,
+                       const fattr3* attribs, uint32_t now);
+
+/// Stores the attributes around a change we made to entry
+/// Returns: 1 if the attributes before our change don't match the cache,
+///          somebody else changed the entry as well
+int ApplyWcc(cache_t* cache, meta_data_entry_t* entry,
+             const wcc_data* wcc, uint32_t now);
 #ifdef _MSC_VER
 #  if _MSC_VER <= 1800
 #    define inline
@@ -222,19 +573,40 @@ static inline uint32_t EntryKey(const char* name, size_t name_length)
     return entry_key;
 }
 
-static inline uint32_t fhandle3_length(const fhandle3* handle)
+static inline uint32_t HighestSetBit(uint32_t v)
 {
-    uint32_t length = 0;
-	int i;
-    for(i = 0; i < 8;i++)
-    {
-        if (((uint32_t*)handle->handle)[i] == 0)
-            break;
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanReverse(&index, v);
+    return index;
+#else
+    return 31 - __builtin_clz(v);
+#endif
+}
+
+/// Returns: the extent which holds position
+static inline uint32_t DirExtentOf(uint32_t position)
+{
+    const uint32_t chunk = position >> DIR_FIRST_EXTENT_SHIFT;
+    return chunk ? HighestSetBit(chunk) + 1 : 0;
+}
+
+/// Returns: the position of the first entry in extent
+static inline uint32_t DirExtentStart(uint32_t extent)
+{
+    return extent ? (DIR_FIRST_EXTENT << (extent - 1)) : 0;
+}
 
-        length += 4;
-    }
+static inline meta_data_entry_t* DirEntry(const cached_dir_t* dir,
+                                          uint32_t position)
+{
+    const uint32_t extent = DirExtentOf(position);
+    return dir->extents[extent] + (position - DirExtentStart(extent));
+}
 
-    return length;
+static inline uint32_t fhandle3_length(const fhandle3* handle)
+{
+    return handle->length;
 }
 
 #  ifndef ALIGN4
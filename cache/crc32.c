@@ -5,6 +5,7 @@
 #endif
 
 #include <assert.h>
+#include <string.h>
 
 #ifdef __ARM_FEATURE_CRC32
 #  define ARM_NEON_CRC32C
@@ -15,6 +16,30 @@
 #  define NO_CRC32C_TABLE
 #endif
 
+/// x86 picks between SSE4.2 and slicing-by-8 on first use
+/// unless the compiler already knows SSE4.2 is there
+#if !defined(ARM_NEON_CRC32C) && (defined(__x86_64__) || defined(_M_X64) \
+                                || defined(__i386__) || defined(_M_IX86))
+#  define X86_SSE42_CRC32C
+#  include <nmmintrin.h>
+#  ifdef _MSC_VER
+#    include <intrin.h>
+#    define SSE42_TARGET
+#  else
+#    include <cpuid.h>
+#    define SSE42_TARGET __attribute__((target("sse4.2")))
+#  endif
+#  if defined(__x86_64__) || defined(_M_X64)
+#    define CRC32C_WORD uint64_t
+#    define SSE42_CRC32C_WORD(CRC, P) \
+        ((uint32_t)_mm_crc32_u64((CRC), crc32c_load64(P)))
+#  else
+#    define CRC32C_WORD uint32_t
+#    define SSE42_CRC32C_WORD(CRC, P) \
+        _mm_crc32_u32((CRC), crc32c_load32(P))
+#  endif
+#endif
+
 #ifdef __cplusplus
 #  define EXTERN_C extern "C"
 #else
@@ -38,6 +63,22 @@ static inline uint32_t crc32c(uint32_t crc, const void* s, const uint32_t len_p)
 
 // implementation
 
+/// buffers can start anywhere, memcpy is the defined way to load a
+/// word from them and compiles to the same single load
+static inline uint32_t crc32c_load32(const uint8_t* p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t crc32c_load64(const uint8_t* p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
 #ifndef NO_CRC32C_TABLE
 static const uint32_t crc32Table[256] = {
     0x00000000L, 0xF26B8303L, 0xE13B70F7L, 0x1350F3F4L,
@@ -110,26 +151,60 @@ static inline uint32_t singletable_crc32c(uint32_t crc, const uint8_t *buf, uint
 {
     const uint8_t *p = buf;
 
-#  ifdef BY_4_OPT
-    uint32_t size4 = size / 4;
-    while(size4--)
-    {
-        const uint32_t fetch = *(uint32_t*)p;
+    while (size--)
+        crc = crc32Table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
 
-        crc = crc32Table[(crc ^ ((fetch >>  0))) & 0xff] ^ (crc >> 8);
-        crc = crc32Table[(crc ^ ((fetch >>  8))) & 0xff] ^ (crc >> 8);
-        crc = crc32Table[(crc ^ ((fetch >> 16))) & 0xff] ^ (crc >> 8);
-        crc = crc32Table[(crc ^ ((fetch >> 24))) & 0xff] ^ (crc >> 8);
-        p += 4;
+    return crc;
+}
+
+/// crc32Table followed by the tables for bytes 1 to 7 positions further
+/// back, filled by init_slicing8_tables
+static uint32_t crc32Tables8[8][256];
+
+static void init_slicing8_tables(void)
+{
+    for(int n = 0; n < 256; n++)
+    {
+        uint32_t crc = crc32Table[n];
+        crc32Tables8[0][n] = crc;
+        for(int k = 1; k < 8; k++)
+        {
+            crc = crc32Table[crc & 0xff] ^ (crc >> 8);
+            crc32Tables8[k][n] = crc;
+        }
     }
+}
 
-    size = size & 3;
-#  endif
+/// slicing-by-8, one lookup per byte but eight independent ones per step
+static uint32_t slicing8_crc32c(uint32_t crc, const void* s, uint32_t len)
+{
+    const uint8_t* p = (const uint8_t*) s;
 
-    while (size--)
+    while (len && ((size_t)p & 3))
+    {
         crc = crc32Table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+        len--;
+    }
 
-    return crc;
+    // little endian like the rest of the cache
+    while (len >= 8)
+    {
+        const uint32_t lo = crc32c_load32(p) ^ crc;
+        const uint32_t hi = crc32c_load32(p + 4);
+
+        crc = crc32Tables8[7][lo & 0xff]
+            ^ crc32Tables8[6][(lo >> 8) & 0xff]
+            ^ crc32Tables8[5][(lo >> 16) & 0xff]
+            ^ crc32Tables8[4][lo >> 24]
+            ^ crc32Tables8[3][hi & 0xff]
+            ^ crc32Tables8[2][(hi >> 8) & 0xff]
+            ^ crc32Tables8[1][(hi >> 16) & 0xff]
+            ^ crc32Tables8[0][hi >> 24];
+        p += 8;
+        len -= 8;
+    }
+
+    return singletable_crc32c(crc, p, len);
 }
 
 #endif // NO_CRC32C_TABLE
@@ -177,7 +252,7 @@ static inline uint32_t intrinsic_crc32c(uint32_t crc, const void* s, uint32_t le
 
         while(len >= 4)
         {
-            crc = __crc32cw(crc, (*(uint32_t*)p));
+            crc = __crc32cw(crc, crc32c_load32(p));
             p += 4;
             len -= 4;
         }
@@ -206,6 +281,210 @@ static inline uint32_t intrinsic_crc32c(uint32_t crc, const void* s, uint32_t le
 
 #endif
 
+#ifdef X86_SSE42_CRC32C
+/// the three streams of sse42_crc32c, the instruction has a latency of
+/// 3 cycles but issues every cycle, so three crcs run in the time of one
+#define CRC32C_LONG 8192
+#define CRC32C_SHORT 256
+
+/// operators moving a crc over CRC32C_LONG and CRC32C_SHORT zero bytes
+static uint32_t crc32c_long[4][256];
+static uint32_t crc32c_short[4][256];
+
+static uint32_t gf2_matrix_times(const uint32_t* mat, uint32_t vec)
+{
+    uint32_t sum = 0;
+    for(; vec; vec >>= 1, mat++)
+    {
+        if (vec & 1)
+            sum ^= *mat;
+    }
+    return sum;
+}
+
+static void gf2_matrix_square(uint32_t* square, const uint32_t* mat)
+{
+    for(int n = 0; n < 32; n++)
+        square[n] = gf2_matrix_times(mat, mat[n]);
+}
+
+/// fills zeros with the operator for len zero bytes, len is a power of 2
+static void init_crc32c_zeros(uint32_t zeros[4][256], uint32_t len)
+{
+    uint32_t odd[32];
+    uint32_t even[32];
+    uint32_t* op = even;
+
+    // one zero bit
+    odd[0] = 0x82F63B78;
+    for(int n = 1; n < 32; n++)
+        odd[n] = 1u << (n - 1);
+
+    gf2_matrix_square(even, odd); // two zero bits
+    gf2_matrix_square(odd, even); // four zero bits
+    for(;;)
+    {
+        gf2_matrix_square(even, odd); // the first time one zero byte
+        op = even;
+        if (!(len >>= 1))
+            break;
+        gf2_matrix_square(odd, even);
+        op = odd;
+        if (!(len >>= 1))
+            break;
+    }
+
+    for(uint32_t n = 0; n < 256; n++)
+    {
+        zeros[0][n] = gf2_matrix_times(op, n);
+        zeros[1][n] = gf2_matrix_times(op, n << 8);
+        zeros[2][n] = gf2_matrix_times(op, n << 16);
+        zeros[3][n] = gf2_matrix_times(op, n << 24);
+    }
+}
+
+static inline uint32_t crc32c_shift(uint32_t zeros[4][256], uint32_t crc)
+{
+    return zeros[0][crc & 0xff] ^ zeros[1][(crc >> 8) & 0xff]
+         ^ zeros[2][(crc >> 16) & 0xff] ^ zeros[3][crc >> 24];
+}
+
+static SSE42_TARGET uint32_t sse42_crc32c(uint32_t crc, const void* s, uint32_t len)
+{
+    const uint8_t* p = (const uint8_t*) s;
+
+    // x86 loads unaligned words at full speed, short names don't pay
+    // for aligning p first
+
+    // three streams of CRC32C_LONG and then CRC32C_SHORT bytes,
+    // the crcs of the second and third start at 0 and get combined
+    // by moving the crc before them over their length
+    while (len >= CRC32C_LONG * 3)
+    {
+        uint32_t crc1 = 0;
+        uint32_t crc2 = 0;
+        const uint8_t* end = p + CRC32C_LONG;
+        do
+        {
+            crc = SSE42_CRC32C_WORD(crc, p);
+            crc1 = SSE42_CRC32C_WORD(crc1, p + CRC32C_LONG);
+            crc2 = SSE42_CRC32C_WORD(crc2, p + CRC32C_LONG * 2);
+            p += sizeof(CRC32C_WORD);
+        } while (p < end);
+        crc = crc32c_shift(crc32c_long, crc) ^ crc1;
+        crc = crc32c_shift(crc32c_long, crc) ^ crc2;
+        p += CRC32C_LONG * 2;
+        len -= CRC32C_LONG * 3;
+    }
+
+    while (len >= CRC32C_SHORT * 3)
+    {
+        uint32_t crc1 = 0;
+        uint32_t crc2 = 0;
+        const uint8_t* end = p + CRC32C_SHORT;
+        do
+        {
+            crc = SSE42_CRC32C_WORD(crc, p);
+            crc1 = SSE42_CRC32C_WORD(crc1, p + CRC32C_SHORT);
+            crc2 = SSE42_CRC32C_WORD(crc2, p + CRC32C_SHORT * 2);
+            p += sizeof(CRC32C_WORD);
+        } while (p < end);
+        crc = crc32c_shift(crc32c_short, crc) ^ crc1;
+        crc = crc32c_shift(crc32c_short, crc) ^ crc2;
+        p += CRC32C_SHORT * 2;
+        len -= CRC32C_SHORT * 3;
+    }
+
+    while (len >= sizeof(CRC32C_WORD))
+    {
+        crc = SSE42_CRC32C_WORD(crc, p);
+        p += sizeof(CRC32C_WORD);
+        len -= sizeof(CRC32C_WORD);
+    }
+
+#  if defined(__x86_64__) || defined(_M_X64)
+    if (len >= 4)
+    {
+        crc = _mm_crc32_u32(crc, crc32c_load32(p));
+        p += 4;
+        len -= 4;
+    }
+#  endif
+
+    while (len--)
+        crc = _mm_crc32_u8(crc, *p++);
+
+    return crc;
+}
+
+static int cpu_has_sse42(void)
+{
+#  if defined(__SSE4_2__)
+    return 1;
+#  elif defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] >> 20) & 1;
+#  else
+    unsigned eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        return 0;
+    return (ecx >> 20) & 1;
+#  endif
+}
+#endif // X86_SSE42_CRC32C
+
+#ifndef ARM_NEON_CRC32C
+typedef uint32_t (*crc32c_fn)(uint32_t crc, const void* s, uint32_t len);
+
+static uint32_t dispatch_crc32c(uint32_t crc, const void* s, uint32_t len);
+
+/// starts out at dispatch_crc32c which replaces it on the first call
+/// the store releases the tables, the loads acquire them
+#  if defined(__GNUC__)
+static crc32c_fn crc32c_impl = dispatch_crc32c;
+#    define CRC32C_LOAD_IMPL() __atomic_load_n(&crc32c_impl, __ATOMIC_ACQUIRE)
+#    define CRC32C_STORE_IMPL(FN) __atomic_store_n(&crc32c_impl, (FN), __ATOMIC_RELEASE)
+#  else
+/// MSVC gives volatile accesses acquire and release semantics
+static crc32c_fn volatile crc32c_impl = dispatch_crc32c;
+#    define CRC32C_LOAD_IMPL() (crc32c_impl)
+#    define CRC32C_STORE_IMPL(FN) (crc32c_impl = (FN))
+#  endif
+#endif
+
+/// fills the tables and picks the implementation, every file including
+/// this one has its own copy, call it before threads compute crcs
+/// otherwise the first crc32c call does it
+static inline void crc32c_init(void)
+{
+#ifndef ARM_NEON_CRC32C
+    crc32c_fn impl = slicing8_crc32c;
+#  ifdef X86_SSE42_CRC32C
+    if (cpu_has_sse42())
+    {
+        init_crc32c_zeros(crc32c_long, CRC32C_LONG);
+        init_crc32c_zeros(crc32c_short, CRC32C_SHORT);
+        impl = sse42_crc32c;
+    }
+    else
+#  endif
+    {
+        init_slicing8_tables();
+    }
+
+    CRC32C_STORE_IMPL(impl);
+#endif
+}
+
+#ifndef ARM_NEON_CRC32C
+static uint32_t dispatch_crc32c(uint32_t crc, const void* s, uint32_t len)
+{
+    crc32c_init();
+    return CRC32C_LOAD_IMPL()(crc, s, len);
+}
+#endif
+
 static inline uint32_t crc32c(uint32_t crc, const void* s, const uint32_t len_p)
 {
     const uint32_t len = len_p;
@@ -213,7 +492,7 @@ static inline uint32_t crc32c(uint32_t crc, const void* s, const uint32_t len_p)
 #ifdef ARM_NEON_CRC32C
     crc = intrinsic_crc32c(crc, p, len);
 #else
-    crc = singletable_crc32c(crc, p, len);
+    crc = CRC32C_LOAD_IMPL()(crc, p, len);
 #endif
     return crc;
 }
@@ -223,6 +502,7 @@ static inline uint32_t crc32c(uint32_t crc, const void* s, const uint32_t len_p)
 
 #ifdef TEST_MAIN
 #include <assert.h>
+#include <string.h>
 int main(int argc, char* argv[])
 {
     assert(CRC32C_S("addr:housenumber") == 0x3F233FF2);
@@ -35,9 +35,15 @@
 #include <stddef.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <time.h>
+#include <pwd.h>
+#include <grp.h>
+#include <pthread.h>
+#include <unistd.h>
 
 #include "../micronfs.h"
 #include "../cache/cached_tree.h"
+#include "micronfs_glue.h"
 
 DEFN_PRINT_NAME_CACHE
 
@@ -56,6 +62,7 @@ static struct options {
 	const char *filename;
 	const char *contents;
 	int show_help;
+	nfs_mount_options_t mount;
 } options;
 
 #define OPTION(t, p)                           \
@@ -63,23 +70,78 @@ static struct options {
 static const struct fuse_opt option_spec[] = {
 	OPTION("--name=%s", filename),
 	OPTION("--contents=%s", contents),
+	OPTION("--host=%s", mount.hostname),
+	OPTION("--export=%s", mount.export_path),
+	OPTION("--lazy", mount.lazy),
+	OPTION("--crawl-threads=%u", mount.crawl_threads),
+	OPTION("--crawl-connections=%u", mount.crawl_connections),
+	OPTION("--checkpoint=%s", mount.checkpoint_path),
+	OPTION("--checkpoint-interval=%u", mount.checkpoint_interval),
+	OPTION("--include=%s", mount.include),
+	OPTION("--exclude=%s", mount.exclude),
+	OPTION("--max-depth=%u", mount.max_depth),
+	OPTION("--max-dir-entries=%u", mount.max_dir_entries),
+	OPTION("--max-entries=%u", mount.max_entries),
+	OPTION("--acregmin=%u", mount.acregmin),
+	OPTION("--acregmax=%u", mount.acregmax),
+	OPTION("--acdirmin=%u", mount.acdirmin),
+	OPTION("--acdirmax=%u", mount.acdirmax),
+	OPTION("--refresh-interval=%u", mount.refresh_interval),
+	OPTION("--negative-entries=%u", mount.negative_entries),
+	OPTION("--access-entries=%u", mount.access_entries),
+	OPTION("--access-timeout=%u", mount.access_timeout),
+	OPTION("--prefetch-size=%u", mount.prefetch_max_size),
+	OPTION("--prefetch-budget=%u", mount.prefetch_budget),
+	OPTION("--open-window=%u", mount.open_window),
 	OPTION("-h", show_help),
 	OPTION("--help", show_help),
 	FUSE_OPT_END
 };
 
+static int logSize = 0;
+char (*log_buffer)[65536] = 0;
+static struct stat logStat;
+static cache_t dirCache;
+
+/// fuse may run requests on several threads, they share dirCache and
+/// nfs_sock_fd, so every request holds cache_lock from start to end
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+/// when the last request finished
+static time_t last_request = 0;
+
+/// seconds without a request before the cache gets compacted
+#define COMPACT_IDLE_SECONDS 2
+
+/// CompactCache moves every name and handle, which takes a while on a
+/// large tree, so it waits for a pause instead of delaying a request
+static void* CompactIdleCache(void* arg)
+{
+    (void) arg;
+    for (;;)
+    {
+        sleep(1);
+        pthread_mutex_lock(&cache_lock);
+        if (time(0) - last_request >= COMPACT_IDLE_SECONDS
+         && CacheWantsCompaction(&dirCache))
+        {
+            CompactCache(&dirCache);
+        }
+        pthread_mutex_unlock(&cache_lock);
+    }
+    return NULL;
+}
+
 static void *cnfs_init(struct fuse_conn_info *conn)
 {
 	(void) conn;
 //	cfg->kernel_cache = 1;
-	return NULL;
+    // started here since fuse_main forks when it goes to the background
+    pthread_t compactor;
+    if (pthread_create(&compactor, 0, CompactIdleCache, 0) == 0)
+        pthread_detach(compactor);
+    return NULL;
 }
 
-static int logSize = 0;
-char (*log_buffer)[65536] = 0;
-static struct stat logStat;
-static cache_t dirCache;
-
 static void AddLog_(const char* msg, int len)
 {
     len = (len ? len : strlen(msg));
@@ -114,23 +176,48 @@ static int cnfs_getattr(const char *path, struct stat *stbuf)
         *stbuf = logStat;
     } else
     {
+        nfs_maybe_refresh(&dirCache, &nfs_sock_fd);
+
         meta_data_entry_t* entry =
-            LookupPath(&dirCache, path, strlen(path));
+            nfs_lookup_path(&dirCache, nfs_sock_fd, path, strlen(path));
 
         if (entry)
         {
+            res = nfs_revalidate(&dirCache, nfs_sock_fd, entry);
+            if (res)
+                return res;
+
             int isDir = entry->type == ENTRY_TYPE_DIRECTORY;
             if (isDir)
             {
+                if (entry->flags & ENTRY_FLAG_UNLISTED)
+                    nfs_list_directory(&dirCache, nfs_sock_fd, entry);
         		stbuf->st_mode = S_IFDIR | 0755;
 		        stbuf->st_nlink = 2 + entry->cached_dir->entries_size;
             }
+            else if (entry->type == ENTRY_TYPE_SYMLINK)
+            {
+                stbuf->st_mode = S_IFLNK | 0777;
+                stbuf->st_size = entry->cached_file->size;
+                stbuf->st_nlink = 1;
+            }
             else
             {
         		stbuf->st_mode = S_IFREG | 0444;
                 stbuf->st_size = entry->cached_file->size;
                 stbuf->st_nlink = 1;
             }
+
+            const cached_attribs_t* attribs = EntryAttribs(entry);
+            if (attribs && attribs->fetched_at)
+            {
+                stbuf->st_mode = (stbuf->st_mode & S_IFMT) | (attribs->mode & 07777);
+                stbuf->st_uid = attribs->uid;
+                stbuf->st_gid = attribs->gid;
+                stbuf->st_nlink = attribs->nlink;
+                stbuf->st_mtime = attribs->mtime.seconds;
+                stbuf->st_ctime = attribs->ctime.seconds;
+            }
         }
         else
         {
@@ -153,8 +240,7 @@ static int cnfs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
 	filler(buf, ".", NULL,  0);
 	filler(buf, "..", NULL, 0);
 
-    meta_data_entry_t* e =
-        LookupPath(&dirCache, path, strlen(path));
+    meta_data_entry_t* e = 0;
 
     if (path[0] == '/' && path[1] == '\0')
     {
@@ -164,6 +250,7 @@ static int cnfs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
     }
     else
     {
+        e = nfs_lookup_path(&dirCache, nfs_sock_fd, path, strlen(path));
         if (e)
         {
             assert(e->type == ENTRY_TYPE_DIRECTORY);
@@ -174,23 +261,36 @@ static int cnfs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
         }
     }
 
+    // a directory whose mtime changed comes back unlisted
+    int res = nfs_revalidate(&dirCache, nfs_sock_fd, e);
+    if (res)
+        return res;
+
+    if (e->flags & ENTRY_FLAG_UNLISTED)
+    {
+        nfs_list_directory(&dirCache, nfs_sock_fd, e);
+    }
 
-    meta_data_entry_t* onePastLast =
-        e->cached_dir->entries + e->cached_dir->entries_size;
 
-    for(meta_data_entry_t* ent = e->cached_dir->entries;
-        ent < onePastLast; ent++)
+    for(uint32_t i = 0; i < e->cached_dir->entries_size; i++)
     {
+        meta_data_entry_t* ent = DirEntry(e->cached_dir, i);
         struct stat s;
+        memset(&s, 0, sizeof(s));
         if (ent->type == ENTRY_TYPE_FILE)
         {
             s.st_size = ent->cached_file->size;
             s.st_mode = S_IFREG;
         }
-        else if (ent->type == ENTRY_TYPE_FILE)
+        else if (ent->type == ENTRY_TYPE_DIRECTORY)
         {
             s.st_mode = S_IFDIR;
         }
+        else if (ent->type == ENTRY_TYPE_SYMLINK)
+        {
+            s.st_size = ent->cached_file->size;
+            s.st_mode = S_IFLNK;
+        }
         filler(buf, toCharPtr(&dirCache, ent->name), &s, 0);
     }
 
@@ -237,23 +337,107 @@ static int cnfs_mkdir (const char *full_path, mode_t mode)
     return 0;
 }
 
-static int CheckAccess(meta_data_entry_t* entry, uint32_t accessFlags)
+static int cnfs_readlink(const char *path, char *buf, size_t size)
 {
-    // -EACCES
+    meta_data_entry_t* entry =
+        nfs_lookup_path(&dirCache, nfs_sock_fd, path, strlen(path));
+
+    if (!entry)
+        return -ENOENT;
+    if (entry->type != ENTRY_TYPE_SYMLINK)
+        return -EINVAL;
+
+    const char* target;
+    int res = nfs_read_link(&dirCache, nfs_sock_fd, entry, &target);
+    if (res)
+        return res;
+
+    // fuse wants it NUL terminated and truncated to fit
+    if (size == 0)
+        return -EINVAL;
+    strncpy(buf, target, size - 1);
+    buf[size - 1] = '\0';
+
     return 0;
 }
 
+/// the supplementary groups of the caller, the first AUTH_UNIX_MAX_GIDS
+/// of them go into gids
+/// Returns: how many the caller has
+static uint32_t CallerGroups(const struct fuse_context* context, uint32_t* gids)
+{
+    gid_t groups[AUTH_UNIX_MAX_GIDS];
+    int n = -1;
+#if defined(FUSE_VERSION) && FUSE_VERSION >= 28 && defined(__linux__)
+    // the groups of the calling process itself
+    n = fuse_getgroups(AUTH_UNIX_MAX_GIDS, groups);
+#endif
+    if (n < 0)
+    {
+        // otherwise the ones the group database lists for the uid
+        struct passwd pw;
+        struct passwd* found = 0;
+        char buffer[1024];
+        n = 0;
+        if (getpwuid_r(context->uid, &pw, buffer, sizeof(buffer), &found) == 0
+         && found)
+        {
+            int count = AUTH_UNIX_MAX_GIDS;
+            if (getgrouplist(found->pw_name, context->gid, groups, &count) < 0
+             && count <= AUTH_UNIX_MAX_GIDS)
+                count = 0;
+            n = count;
+        }
+    }
+
+    for (int i = 0; i < n && i < AUTH_UNIX_MAX_GIDS; i++)
+        gids[i] = groups[i];
+    return (uint32_t)n;
+}
+
+static int CheckAccess(meta_data_entry_t* entry, uint32_t accessFlags)
+{
+    uint32_t access = 0;
+    switch (accessFlags & O_ACCMODE)
+    {
+        case O_RDONLY:
+            access = ACCESS3_READ;
+        break;
+        case O_WRONLY:
+            access = ACCESS3_MODIFY;
+        break;
+        case O_RDWR:
+            access = ACCESS3_READ | ACCESS3_MODIFY;
+        break;
+    }
+
+    const struct fuse_context* context = fuse_get_context();
+    uint32_t gids[AUTH_UNIX_MAX_GIDS];
+    const uint32_t n_gids = CallerGroups(context, gids);
+    return nfs_check_access(&dirCache, nfs_sock_fd, entry,
+                            context->uid, context->gid, n_gids, gids, access);
+}
+
 static int cnfs_open(const char *path, struct fuse_file_info *fi)
 {
     if (strcmp(path, "/log") == 0)
     {
         return 0;
     }
-    const char* mPath = path + 1;
-    meta_data_entry_t* entry = LookupPath(&dirCache, path, strlen(path));
+    meta_data_entry_t* entry =
+        nfs_lookup_path(&dirCache, nfs_sock_fd, path, strlen(path));
 
     if (entry)
     {
+        if (entry->type == ENTRY_TYPE_FILE && !(entry->flags & ENTRY_FLAG_VIRTUAL))
+        {
+            int keep = nfs_open_file(&dirCache, nfs_sock_fd, entry,
+                                     options.mount.open_window);
+            if (keep < 0)
+                return keep;
+            // the kernel may keep its pages as long as we keep ours
+            fi->keep_cache = keep;
+        }
         return CheckAccess(entry, (fi->flags & O_ACCMODE));
     }
 
@@ -269,31 +453,55 @@ static int cnfs_open(const char *path, struct fuse_file_info *fi)
 
 	return 0;
 }
-int nfs_write(int sock, const fhandle3*, const void* data, uint32_t size, uint64_t offset);
+int64_t nfs_write(int sock, const fhandle3*, const void* data, uint32_t size, uint64_t offset,
+                  wcc_data* wcc);
+
+/** Called on every close of a file */
+static int cnfs_flush(const char *path, struct fuse_file_info *fi)
+{
+    meta_data_entry_t* entry = LookupPath(&dirCache, path, strlen(path));
+    if (!entry || entry->type != ENTRY_TYPE_FILE
+     || (entry->flags & ENTRY_FLAG_VIRTUAL))
+    {
+        return 0;
+    }
+
+    return nfs_flush_file(&dirCache, nfs_sock_fd, entry);
+}
+
+static int cnfs_fsync(const char *path, int datasync, struct fuse_file_info *fi)
+{
+    return cnfs_flush(path, fi);
+}
 
 static int cnfs_write(const char *path, const char *buf, size_t size, off_t offset,
 		      struct fuse_file_info *fi)
 {
     printf("Calling write\n");
-    assert(offset == 0);
     meta_data_entry_t* e;
     e = LookupPath(&dirCache, path, strlen(path));
     if (e)
     {
         int isVirtual = e->flags & ENTRY_FLAG_VIRTUAL;
-        if (!offset)
-        {
-            AddFile(&dirCache, path, buf, size, isVirtual);
-        }
-        else
-        {
-            UpdateFile(&dirCache, path, buf, size, offset, isVirtual);
-        }
+        // only the blocks whose content changed need to go over the wire
+        file_range_t changed[FILE_MAX_DIRTY_RANGES];
+        uint32_t n_changed =
+            WriteFileBlocks(e->cached_file, buf, size, offset,
+                            changed, sizeof(changed) / sizeof(changed[0]));
 
         if (!isVirtual)
         {
-            fhandle3 handle = ptrToHandle(&dirCache, e->handle);
-            nfs_write(nfs_sock_fd, &handle, (const void*)buf, size, offset);
+            // written back on close, or earlier if they don't fit anymore
+            for(uint32_t i = 0; i < n_changed; i++)
+            {
+                if (AddDirtyRange(e->cached_file, changed[i].offset, changed[i].size))
+                    continue;
+
+                int res = nfs_flush_file(&dirCache, nfs_sock_fd, e);
+                if (res)
+                    return res;
+                AddDirtyRange(e->cached_file, changed[i].offset, changed[i].size);
+            }
         }
 
         return size;
@@ -303,7 +511,8 @@ static int cnfs_write(const char *path, const char *buf, size_t size, off_t offs
         return -ENOENT;
     }
 }
-fhandle3 nfs_create(SOCKET nfs_sock_fd, const fhandle3* parentDir, const char* filename, mode3 mode);
+fhandle3 nfs_create(SOCKET nfs_sock_fd, const fhandle3* parentDir, const char* filename, mode3 mode,
+                    fattr3* attribs, wcc_data* dir_wcc);
 
 /*
     #define	__S_IFDIR	0040000	// Directory.
@@ -341,16 +550,29 @@ static int cnfs_mknod(const char * path, mode_t mode, dev_t dev)
     // const char* parentPath = toCharPtr(&dirCache, result.parentDir->cached_dir->fullPath);
     // LookupPath(&dirCache, parentPath, strlen(parentPath));
     fhandle3 dirHandle = ptrToHandle(&dirCache, result.parentDir->handle);
+    fattr3 attribs;
+    wcc_data dirWcc;
     fhandle3 handle =
-        nfs_create(nfs_sock_fd, &dirHandle, result.entry_name, mode & 0xFFFF);
+        nfs_create(nfs_sock_fd, &dirHandle, result.entry_name, mode & 0xFFFF,
+                   &attribs, &dirWcc);
+    if (!fhandle3_length(&handle))
+        return -EIO;
+
+    const uint32_t now = (uint32_t)time(0);
+    // somebody else changed the directory, list it again on next use
+    if (ApplyWcc(&dirCache, result.parentDir, &dirWcc, now))
+        result.parentDir->flags |= ENTRY_FLAG_UNLISTED;
 
     meta_data_entry_t* entry =
         CreateFileEntry(&dirCache, result.parentDir, result.entry_name, result.entry_name_length);
     entry->handle = handleToPtr(&dirCache, &handle);
+    if (attribs.type != NF3NON)
+        UpdateAttribs(&dirCache, entry, &attribs, now);
     return 0;
 }
 
-int nfs_read(int sock, const fhandle3*, void* data, uint32_t size, uint64_t offset);
+int64_t nfs_read(int sock, const fhandle3*, void* data, uint32_t size, uint64_t offset,
+                 fattr3* post_op);
 
 static int cnfs_read(const char *path, char *buf, size_t size, off_t offset,
 		      struct fuse_file_info *fi)
@@ -390,17 +612,32 @@ static int cnfs_read(const char *path, char *buf, size_t size, off_t offset,
         if (entry->type == ENTRY_TYPE_FILE)
         {
             fhandle3 handle = ptrToHandle(&dirCache, entry->handle);
-            if (offset == 0)
-            {
-                entry->cached_file->data =
-                    realloc(entry->cached_file->data, entry->cached_file->size);
-            }
             int read = entry->cached_file->size;
             if (!(entry->flags & ENTRY_FLAG_VIRTUAL))
             {
+                // prefetched or read before, as long as it didn't change
+                int res = nfs_revalidate(&dirCache, nfs_sock_fd, entry);
+                if (res)
+                    return res;
+                read = ReadFileBlocks(entry->cached_file, buf, size, offset);
+                if (read >= 0)
+                    return read;
+
+                // the server has to see our writes before we read from it
+                res = nfs_flush_file(&dirCache, nfs_sock_fd, entry);
+                if (res)
+                    return res;
+
+                fattr3 attribs;
                 read = nfs_read(nfs_sock_fd, &handle
-                    , buf, size, offset);
-                memcpy(entry->cached_file->data + offset, buf, read);
+                    , buf, size, offset, &attribs);
+                if (ApplyPostOpAttribs(&dirCache, entry, &attribs, (uint32_t)time(0)))
+                {
+                    InvalidateFileBlocks(entry->cached_file);
+                    entry->cached_file->size = entry->cached_file->attribs.size;
+                }
+                if (read > 0)
+                    FillFileBlocks(entry->cached_file, buf, read, offset);
             }
             else
             {
@@ -447,19 +684,6 @@ static int cnfs_truncate (const char * full_path, off_t newSize)
     return 0;
 }
 
-void FreeEntry(cache_t* cache, cached_dir_t* parentDir, meta_data_entry_t* entry)
-{
-    assert(entry >= parentDir->entries && entry < parentDir->entries + parentDir->entries_size);
-    size_t entry_idx = entry - parentDir->entries;
-    size_t how_many = parentDir->entries_size - entry_idx;
-    if (how_many)
-    {
-        memmove(entry, entry + 1, how_many - 1);
-    }
-    parentDir->entries_size--;
-}
-
-
 void nfs_remove(SOCKET nfs_fd, fhandle3* dirHandle, const char* filename, uint32_t filename_length);
 
 /** Remove a file */
@@ -489,7 +713,7 @@ int cnfs_unlink (const char * full_path)
     fhandle3 handle = ptrToHandle(&dirCache, result.parentDir->handle);
     nfs_remove(nfs_sock_fd, &handle, result.entry_name, result.entry_name_length);
     
-    FreeEntry(&dirCache, result.parentDir->cached_dir, file);
+    RemoveEntry(&dirCache, result.parentDir->cached_dir, file);
 
     return 0;
 }
@@ -518,21 +742,58 @@ int cnfs_rmdir (const char * full_path)
     {
         return -ENOTEMPTY;
     }
-    FreeEntry(&dirCache, result.parentDir->cached_dir, dir);
+    RemoveEntry(&dirCache, result.parentDir->cached_dir, dir);
+    return 0;
+}
+
+/// defines locked_NAME, which runs cnfs_NAME holding cache_lock
+#define DEFN_LOCKED(NAME, PARAMS, ARGS) \
+static int locked_##NAME PARAMS \
+{ \
+    pthread_mutex_lock(&cache_lock); \
+    int res = cnfs_##NAME ARGS; \
+    last_request = time(0); \
+    pthread_mutex_unlock(&cache_lock); \
+    return res; \
 }
 
+DEFN_LOCKED(getattr, (const char* path, struct stat* stbuf), (path, stbuf))
+DEFN_LOCKED(readdir, (const char* path, void* buf, fuse_fill_dir_t filler,
+                      off_t offset, struct fuse_file_info* fi),
+                     (path, buf, filler, offset, fi))
+DEFN_LOCKED(readlink, (const char* path, char* buf, size_t size), (path, buf, size))
+DEFN_LOCKED(truncate, (const char* path, off_t size), (path, size))
+DEFN_LOCKED(unlink, (const char* path), (path))
+DEFN_LOCKED(rmdir, (const char* path), (path))
+DEFN_LOCKED(open, (const char* path, struct fuse_file_info* fi), (path, fi))
+DEFN_LOCKED(flush, (const char* path, struct fuse_file_info* fi), (path, fi))
+DEFN_LOCKED(fsync, (const char* path, int datasync, struct fuse_file_info* fi),
+                   (path, datasync, fi))
+DEFN_LOCKED(read, (const char* path, char* buf, size_t size, off_t offset,
+                   struct fuse_file_info* fi),
+                  (path, buf, size, offset, fi))
+DEFN_LOCKED(write, (const char* path, const char* buf, size_t size, off_t offset,
+                    struct fuse_file_info* fi),
+                   (path, buf, size, offset, fi))
+DEFN_LOCKED(mknod, (const char* path, mode_t mode, dev_t dev), (path, mode, dev))
+DEFN_LOCKED(mkdir, (const char* path, mode_t mode), (path, mode))
+
 static const struct fuse_operations cnfs_oper = {
 	.init       = cnfs_init,
-	.getattr    = cnfs_getattr,
-	.readdir    = cnfs_readdir,
-    .truncate   = cnfs_truncate,
-    .unlink     = cnfs_unlink,
-    .rmdir      = cnfs_rmdir,
-	// .open       = cnfs_open,
-	.read       = cnfs_read,
-    .write      = cnfs_write,
-    .mknod      = cnfs_mknod,
-    .mkdir      = cnfs_mkdir,
+	.getattr    = locked_getattr,
+	.readdir    = locked_readdir,
+    .readlink   = locked_readlink,
+    .truncate   = locked_truncate,
+    .unlink     = locked_unlink,
+    .rmdir      = locked_rmdir,
+	.open       = locked_open,
+	.flush      = locked_flush,
+	.release    = locked_flush,
+	.fsync      = locked_fsync,
+	.read       = locked_read,
+    .write      = locked_write,
+    .mknod      = locked_mknod,
+    .mkdir      = locked_mkdir,
 };
 
 static void show_help(const char *progname)
@@ -543,12 +804,61 @@ static void show_help(const char *progname)
 	       "                        (default: \"hello\")\n"
 	       "    --contents=<s>      Contents \"hello\" file\n"
 	       "                        (default \"Hello, World!\\n\")\n"
+	       "    --host=<s>          NFS server to mount from\n"
+	       "                        (default: \"192.168.178.26\")\n"
+	       "    --export=<s>        Exported directory to mount\n"
+	       "                        (default: \"/nfs/git\")\n"
+	       "    --lazy              List directories on first use\n"
+	       "                        instead of crawling at mount\n"
+	       "    --crawl-threads=<n> Threads crawling the export at mount\n"
+	       "                        (default: 4)\n"
+	       "    --crawl-connections=<n>\n"
+	       "                        Connections shared by the crawl threads\n"
+	       "                        (default: one per thread)\n"
+	       "    --checkpoint=<s>    Save crawl progress to this file and\n"
+	       "                        resume from it after an interruption\n"
+	       "    --checkpoint-interval=<n>\n"
+	       "                        Seconds between checkpoints\n"
+	       "                        (default: 30)\n"
+	       "    --include=<s>       Only crawl these subtrees, colon\n"
+	       "                        separated globs like \"src:lib/*\"\n"
+	       "    --exclude=<s>       Don't crawl these directories, colon\n"
+	       "                        separated globs like \".git:node_modules\"\n"
+	       "    --max-depth=<n>     Don't crawl deeper than n levels\n"
+	       "    --max-dir-entries=<n>\n"
+	       "                        Stop crawling a directory after n entries\n"
+	       "    --max-entries=<n>   Stop the crawl after n entries\n"
+	       "    --acregmin=<n> --acregmax=<n>\n"
+	       "                        Seconds file attributes are cached\n"
+	       "                        (default: 3 to 60)\n"
+	       "    --acdirmin=<n> --acdirmax=<n>\n"
+	       "                        Seconds directory attributes are cached\n"
+	       "                        (default: 30 to 60)\n"
+	       "    --refresh-interval=<n>\n"
+	       "                        Seconds between checks of all cached\n"
+	       "                        directories for changes (default: off)\n"
+	       "    --negative-entries=<n>\n"
+	       "                        Names remembered as missing, 0 to\n"
+	       "                        always ask the server (default: 4096)\n"
+	       "    --access-entries=<n>\n"
+	       "                        Permission checks remembered per\n"
+	       "                        file and user (default: 4096)\n"
+	       "    --access-timeout=<n>\n"
+	       "                        Seconds a permission check is trusted,\n"
+	       "                        0 to always ask the server (default: 60)\n"
+	       "    --prefetch-size=<n>\n"
+	       "                        Read files up to n bytes while crawling\n"
+	       "                        (default: 0, off)\n"
+	       "    --prefetch-budget=<n>\n"
+	       "                        MiB of file content the crawl may\n"
+	       "                        prefetch (default: 64)\n"
+	       "    --open-window=<n>\n"
+	       "                        Seconds an open trusts attributes\n"
+	       "                        without GETATTR, 0 for strict\n"
+	       "                        close-to-open (default: 1)\n"
 	       "\n");
 }
 
-extern int nfs_init_cache(cache_t* dirCache, int argc, char* argv[]);
-extern int connect_name(const char* hostname, const char* port);
-
 int main(int argc, char *argv[])
 {
 	int ret;
@@ -560,15 +870,20 @@ int main(int argc, char *argv[])
 
     log_buffer = malloc(sizeof(char[65536]));
 
-    nfs_init_cache(&dirCache, 1, argv);
-    
-    nfs_sock_fd = connect_name("192.168.178.26", "2049");
-
 	/* Set defaults -- we have to use strdup so that
 	   fuse_opt_parse can free the defaults if other
 	   values are specified */
 	options.filename = strdup("hello");
 	options.contents = strdup("Hello World!\n");
+	options.mount.hostname = strdup("192.168.178.26");
+	options.mount.export_path = strdup("/nfs/git");
+	options.mount.crawl_threads = 4;
+	options.mount.checkpoint_interval = 30;
+	options.mount.negative_entries = 4096;
+	options.mount.access_entries = 4096;
+	options.mount.access_timeout = 60;
+	options.mount.prefetch_budget = 64;
+	options.mount.open_window = 1;
 
 	/* Parse options */
 	if (fuse_opt_parse(&args, &options, option_spec, NULL) == -1)
@@ -584,6 +899,13 @@ int main(int argc, char *argv[])
 		assert(fuse_opt_add_arg(&args, "--help") == 0);
 		args.argv[0][0] = '\0';
 	}
+	else
+	{
+		if (nfs_init_cache(&dirCache, &options.mount) != 0)
+			return 1;
+
+		nfs_sock_fd = nfs_connect_server();
+	}
 
 	ret = fuse_main(args.argc, args.argv, &cnfs_oper, NULL);
 	fuse_opt_free_args(&args);
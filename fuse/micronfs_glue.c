@@ -1,14 +1,1445 @@
 #include "../nfs_common.inl"
+#include "micronfs_glue.h"
+#include <pthread.h>
+#include <time.h>
+#include <fnmatch.h>
 
-extern int nfs_init_cache(cache_t* dirCache, int argc, char* argv[])
+static nfs_mount_options_t mount_options;
+
+typedef struct crawl_item_t
+{
+    meta_data_entry_t* dir;
+    fhandle3 handle;
+
+    /// where the listing continues, both 0 for a fresh listing
+    cookie3 cookie;
+    cookie3 verifier;
+    /// mtime of the directory before it was listed
+    /// a checkpointed cookie is only reused while it's unchanged
+    nfstime3 mtime;
+
+    uint32_t depth; /// 0 for the root
+    /// the directory or one of its parents matched an include pattern
+    uint32_t included;
+} crawl_item_t;
+
+/// a small file whose content is read while the crawl goes on
+typedef struct prefetch_item_t
+{
+    meta_data_entry_t* file;
+    fhandle3 handle;
+    uint32_t size;
+} prefetch_item_t;
+
+/// the owner pushes and pops at the bottom (depth first)
+/// other workers steal from the top, where the biggest subtrees wait
+typedef struct crawl_deque_t
+{
+    pthread_mutex_t lock;
+    crawl_item_t* items;
+    uint32_t top;
+    uint32_t bottom;
+    uint32_t capacity;
+} crawl_deque_t;
+
+/// which directories the crawl descends into
+/// everything else stays unlisted and is listed on first use
+typedef struct crawl_scope_t
+{
+    char* patterns; /// storage for both lists
+    const char** include;
+    const char** exclude;
+    uint32_t n_include;
+    uint32_t n_exclude;
+
+    uint32_t max_depth;
+    uint32_t max_dir_entries;
+    uint32_t max_entries;
+} crawl_scope_t;
+
+struct crawler_t;
+
+typedef struct crawl_worker_t
+{
+    struct crawler_t* crawler;
+    crawl_deque_t deque;
+    pthread_t thread;
+    uint32_t index;
+
+    /// the directory being listed, part of the checkpointed frontier
+    crawl_item_t current;
+    int busy;
+} crawl_worker_t;
+
+typedef struct crawler_t
+{
+    cache_t* cache;
+    /// guards every access to the cache while the workers run
+    pthread_mutex_t cache_lock;
+
+    crawl_worker_t* workers;
+    uint32_t n_workers;
+
+    /// connection pool, connections are opened on demand
+    pthread_mutex_t pool_lock;
+    pthread_cond_t pool_cond;
+    SOCKET* free_connections;
+    uint32_t n_free_connections;
+    uint32_t n_connections;
+    uint32_t max_connections;
+
+    /// directories pushed but not yet listed
+    /// generation changes on every push so idle workers don't miss work
+    pthread_mutex_t idle_lock;
+    pthread_cond_t idle_cond;
+    uint32_t pending;
+    uint32_t generation;
+
+    /// workers touching the frontier (deques, current items, cookies)
+    /// a checkpoint waits until there are none and keeps new ones out
+    uint32_t active;
+    int checkpointing;
+    time_t last_checkpoint;
+    const char* checkpoint_path;
+    uint32_t checkpoint_interval;
+
+    crawl_scope_t scope;
+    /// entries the crawl added, guarded by cache_lock
+    uint32_t n_entries;
+    int out_of_budget;
+
+    /// files up to prefetch_max_size are read once no directory is
+    /// left to list, they count as pending but aren't checkpointed
+    pthread_mutex_t prefetch_lock;
+    prefetch_item_t* prefetch;
+    uint32_t n_prefetch;
+    uint32_t prefetch_capacity;
+    uint32_t prefetch_max_size;
+    /// bytes left for file content, guarded by cache_lock
+    uint64_t prefetch_budget;
+} crawler_t;
+
+typedef struct crawl_cb_args_t
+{
+    crawl_worker_t* worker;
+    const crawl_item_t* item;
+    populate_cache_cb_args_t populate;
+
+    uint32_t n_entries;
+    /// stopped early because of a budget
+    int truncated;
+} crawl_cb_args_t;
+
+static void Deque_Push(crawl_deque_t* self, const crawl_item_t* item)
+{
+    pthread_mutex_lock(&self->lock);
+    if (self->bottom == self->capacity)
+    {
+        if (self->top)
+        {
+            memmove(self->items, self->items + self->top,
+                    (self->bottom - self->top) * sizeof(crawl_item_t));
+            self->bottom -= self->top;
+            self->top = 0;
+        }
+        if (self->bottom == self->capacity)
+        {
+            self->capacity = (self->capacity ? self->capacity * 2 : 64);
+            self->items = (crawl_item_t*)
+                realloc(self->items, self->capacity * sizeof(crawl_item_t));
+        }
+    }
+    self->items[self->bottom++] = *item;
+    pthread_mutex_unlock(&self->lock);
+}
+
+static int Deque_Pop(crawl_deque_t* self, crawl_item_t* item)
+{
+    int result = 0;
+    pthread_mutex_lock(&self->lock);
+    if (self->bottom > self->top)
+    {
+        *item = self->items[--self->bottom];
+        result = 1;
+        if (self->bottom == self->top)
+            self->bottom = self->top = 0;
+    }
+    pthread_mutex_unlock(&self->lock);
+    return result;
+}
+
+static int Deque_Steal(crawl_deque_t* self, crawl_item_t* item)
+{
+    int result = 0;
+    pthread_mutex_lock(&self->lock);
+    if (self->bottom > self->top)
+    {
+        *item = self->items[self->top++];
+        result = 1;
+        if (self->bottom == self->top)
+            self->bottom = self->top = 0;
+    }
+    pthread_mutex_unlock(&self->lock);
+    return result;
+}
+
+static void PushWork(crawl_worker_t* worker, const crawl_item_t* item)
+{
+    crawler_t* crawler = worker->crawler;
+
+    pthread_mutex_lock(&crawler->idle_lock);
+    crawler->pending++;
+    crawler->generation++;
+    pthread_mutex_unlock(&crawler->idle_lock);
+
+    Deque_Push(&worker->deque, item);
+
+    pthread_mutex_lock(&crawler->idle_lock);
+    pthread_cond_broadcast(&crawler->idle_cond);
+    pthread_mutex_unlock(&crawler->idle_lock);
+}
+
+static int StealWork(crawl_worker_t* worker, crawl_item_t* item)
+{
+    crawler_t* crawler = worker->crawler;
+
+    for(uint32_t i = 1; i < crawler->n_workers; i++)
+    {
+        crawl_worker_t* victim =
+            crawler->workers + ((worker->index + i) % crawler->n_workers);
+        if (Deque_Steal(&victim->deque, item))
+            return 1;
+    }
+
+    return 0;
+}
+
+static void PushPrefetch(crawler_t* crawler, const prefetch_item_t* item)
+{
+    pthread_mutex_lock(&crawler->prefetch_lock);
+    if (crawler->n_prefetch == crawler->prefetch_capacity)
+    {
+        crawler->prefetch_capacity = (crawler->prefetch_capacity
+                                   ? crawler->prefetch_capacity * 2 : 64);
+        crawler->prefetch = (prefetch_item_t*) realloc(crawler->prefetch,
+            crawler->prefetch_capacity * sizeof(prefetch_item_t));
+    }
+    crawler->prefetch[crawler->n_prefetch++] = *item;
+    pthread_mutex_unlock(&crawler->prefetch_lock);
+
+    pthread_mutex_lock(&crawler->idle_lock);
+    crawler->pending++;
+    crawler->generation++;
+    pthread_cond_broadcast(&crawler->idle_cond);
+    pthread_mutex_unlock(&crawler->idle_lock);
+}
+
+static int PopPrefetch(crawler_t* crawler, prefetch_item_t* item)
+{
+    int result = 0;
+    pthread_mutex_lock(&crawler->prefetch_lock);
+    if (crawler->n_prefetch)
+    {
+        *item = crawler->prefetch[--crawler->n_prefetch];
+        result = 1;
+    }
+    pthread_mutex_unlock(&crawler->prefetch_lock);
+    return result;
+}
+
+static void EnterFrontier(crawler_t* crawler)
+{
+    pthread_mutex_lock(&crawler->idle_lock);
+    while (crawler->checkpointing)
+        pthread_cond_wait(&crawler->idle_cond, &crawler->idle_lock);
+    crawler->active++;
+    pthread_mutex_unlock(&crawler->idle_lock);
+}
+
+static void LeaveFrontier(crawler_t* crawler)
+{
+    pthread_mutex_lock(&crawler->idle_lock);
+    if (--crawler->active == 0 && crawler->checkpointing)
+        pthread_cond_broadcast(&crawler->idle_cond);
+    pthread_mutex_unlock(&crawler->idle_lock);
+}
+
+#define CHECKPOINT_MAGIC "CNFSCRW3"
+
+static void WriteCheckpointItem(FILE* f, cache_t* cache, const crawl_item_t* item)
+{
+    const char* path = "/";
+    if (item->dir != cache->root)
+        path = toCharPtr(cache, item->dir->cached_dir->fullPath);
+    uint32_t path_length = strlen(path);
+
+    fwrite(&item->handle, sizeof(item->handle), 1, f);
+    fwrite(&item->cookie, sizeof(item->cookie), 1, f);
+    fwrite(&item->verifier, sizeof(item->verifier), 1, f);
+    fwrite(&item->mtime, sizeof(item->mtime), 1, f);
+    fwrite(&item->depth, sizeof(item->depth), 1, f);
+    fwrite(&item->included, sizeof(item->included), 1, f);
+    fwrite(&path_length, sizeof(path_length), 1, f);
+    fwrite(path, 1, path_length, f);
+}
+
+/// snapshots the frontier into the checkpoint file
+/// if the last checkpoint is older than the interval
+static void MaybeCheckpoint(crawler_t* crawler)
+{
+    if (!crawler->checkpoint_path)
+        return;
+
+    pthread_mutex_lock(&crawler->idle_lock);
+    time_t now = time(0);
+    if (crawler->checkpointing
+     || now - crawler->last_checkpoint < crawler->checkpoint_interval)
+    {
+        pthread_mutex_unlock(&crawler->idle_lock);
+        return;
+    }
+    crawler->last_checkpoint = now;
+    crawler->checkpointing = 1;
+    while (crawler->active)
+        pthread_cond_wait(&crawler->idle_cond, &crawler->idle_lock);
+
+    // nobody is inside the frontier now, deques and cache are quiescent
+    char tmp_path[4096];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", crawler->checkpoint_path);
+    FILE* f = fopen(tmp_path, "wb");
+    if (f)
+    {
+        uint32_t count = 0;
+        for(uint32_t i = 0; i < crawler->n_workers; i++)
+        {
+            const crawl_worker_t* worker = crawler->workers + i;
+            count += worker->busy + (worker->deque.bottom - worker->deque.top);
+        }
+
+        fwrite(CHECKPOINT_MAGIC, 1, 8, f);
+        fwrite(&crawler->cache->rootHandle, sizeof(fhandle3), 1, f);
+        fwrite(&count, sizeof(count), 1, f);
+
+        for(uint32_t i = 0; i < crawler->n_workers; i++)
+        {
+            const crawl_worker_t* worker = crawler->workers + i;
+            if (worker->busy)
+                WriteCheckpointItem(f, crawler->cache, &worker->current);
+            for(uint32_t j = worker->deque.top; j < worker->deque.bottom; j++)
+                WriteCheckpointItem(f, crawler->cache, worker->deque.items + j);
+        }
+    }
+
+    crawler->checkpointing = 0;
+    pthread_cond_broadcast(&crawler->idle_cond);
+    pthread_mutex_unlock(&crawler->idle_lock);
+
+    if (f)
+    {
+        if (fclose(f) == 0)
+            rename(tmp_path, crawler->checkpoint_path);
+        else
+            remove(tmp_path);
+    }
+}
+
+static SOCKET AcquireConnection(crawler_t* crawler)
+{
+    SOCKET result = INVALID_SOCKET;
+    int openNew = 0;
+
+    pthread_mutex_lock(&crawler->pool_lock);
+    for(;;)
+    {
+        if (crawler->n_free_connections)
+        {
+            result = crawler->free_connections[--crawler->n_free_connections];
+            break;
+        }
+        if (crawler->n_connections < crawler->max_connections)
+        {
+            crawler->n_connections++;
+            openNew = 1;
+            break;
+        }
+        pthread_cond_wait(&crawler->pool_cond, &crawler->pool_lock);
+    }
+    pthread_mutex_unlock(&crawler->pool_lock);
+
+    if (openNew)
+    {
+        result = nfs_connect_server();
+        if (result == INVALID_SOCKET)
+        {
+            pthread_mutex_lock(&crawler->pool_lock);
+            crawler->n_connections--;
+            pthread_cond_signal(&crawler->pool_cond);
+            pthread_mutex_unlock(&crawler->pool_lock);
+        }
+    }
+
+    return result;
+}
+
+static void ReleaseConnection(crawler_t* crawler, SOCKET sock)
+{
+    pthread_mutex_lock(&crawler->pool_lock);
+    crawler->free_connections[crawler->n_free_connections++] = sock;
+    pthread_cond_signal(&crawler->pool_cond);
+    pthread_mutex_unlock(&crawler->pool_lock);
+}
+
+/// closes a connection whose call failed instead of putting it back,
+/// the rest of a broken reply would be read by the next call on it
+/// the next AcquireConnection opens a fresh one in its place
+static void DiscardConnection(crawler_t* crawler, SOCKET sock)
+{
+    closesocket(sock);
+
+    pthread_mutex_lock(&crawler->pool_lock);
+    crawler->n_connections--;
+    pthread_cond_signal(&crawler->pool_cond);
+    pthread_mutex_unlock(&crawler->pool_lock);
+}
+
+/// splits a colon separated list of globs
+/// leading slashes are dropped, paths are matched relative to the root
+static uint32_t SplitPatterns(char* list, const char** patterns)
+{
+    uint32_t n = 0;
+    for(char* pattern = strtok(list, ":"); pattern; pattern = strtok(0, ":"))
+    {
+        while (*pattern == '/')
+            pattern++;
+        if (*pattern)
+            patterns[n++] = pattern;
+    }
+    return n;
+}
+
+static void InitCrawlScope(crawl_scope_t* scope, const nfs_mount_options_t* options)
+{
+    memset(scope, 0, sizeof(crawl_scope_t));
+
+    size_t include_length = options->include ? strlen(options->include) : 0;
+    size_t exclude_length = options->exclude ? strlen(options->exclude) : 0;
+
+    // a list of n characters holds at most n / 2 + 1 patterns
+    scope->patterns = (char*) malloc(include_length + exclude_length + 2);
+    scope->include = (const char**)
+        calloc(include_length / 2 + 1 + exclude_length / 2 + 1, sizeof(char*));
+    scope->exclude = scope->include + include_length / 2 + 1;
+
+    char* include = scope->patterns;
+    char* exclude = scope->patterns + include_length + 1;
+    memcpy(include, options->include ? options->include : "", include_length + 1);
+    memcpy(exclude, options->exclude ? options->exclude : "", exclude_length + 1);
+
+    scope->n_include = SplitPatterns(include, scope->include);
+    scope->n_exclude = SplitPatterns(exclude, scope->exclude);
+
+    scope->max_depth = options->max_depth;
+    scope->max_dir_entries = options->max_dir_entries;
+    scope->max_entries = options->max_entries;
+}
+
+static void FreeCrawlScope(crawl_scope_t* scope)
+{
+    free(scope->include);
+    free(scope->patterns);
+}
+
+/// matches path (depth components) against the leading components
+/// of the include patterns, so the parents of an include get crawled too
+/// Returns: 0 no match, 1 on the way to a match, 2 a full match
+static int MatchInclude(const crawl_scope_t* scope, const char* path, uint32_t depth)
+{
+    int result = 0;
+
+    for(uint32_t i = 0; i < scope->n_include; i++)
+    {
+        const char* pattern = scope->include[i];
+        const char* end = pattern;
+        uint32_t components = 1;
+        for(; *end; end++)
+        {
+            if (*end == '/' && components++ == depth)
+                break;
+        }
+
+        char prefix[4096];
+        size_t prefix_length = end - pattern;
+        if (prefix_length >= sizeof(prefix))
+            continue;
+        memcpy(prefix, pattern, prefix_length);
+        prefix[prefix_length] = '\0';
+
+        if (fnmatch(prefix, path, FNM_PATHNAME) == 0)
+        {
+            if (*end == '\0')
+                return 2;
+            result = 1;
+        }
+    }
+
+    return result;
+}
+
+/// decides if the subdirectory name of parent is crawled
+/// and fills in depth and included of the item for it
+static int InCrawlScope(const crawl_scope_t* scope, cache_t* cache,
+                        const crawl_item_t* parent, const char* name,
+                        crawl_item_t* item)
+{
+    item->depth = parent->depth + 1;
+    if (scope->max_depth && item->depth > scope->max_depth)
+        return 0;
+
+    if (!scope->n_include && !scope->n_exclude)
+    {
+        item->included = 1;
+        return 1;
+    }
+
+    char path[4096];
+    const char* parent_path = "";
+    if (parent->dir != cache->root)
+        parent_path = toCharPtr(cache, parent->dir->cached_dir->fullPath) + 1;
+    if (snprintf(path, sizeof(path), "%s%s%s", parent_path,
+                 *parent_path ? "/" : "", name) >= (int)sizeof(path))
+        return 0;
+
+    for(uint32_t i = 0; i < scope->n_exclude; i++)
+    {
+        const char* pattern = scope->exclude[i];
+        if (strchr(pattern, '/') ? fnmatch(pattern, path, FNM_PATHNAME) == 0
+                                 : fnmatch(pattern, name, 0) == 0)
+            return 0;
+    }
+
+    item->included = parent->included;
+    if (!item->included)
+    {
+        int match = MatchInclude(scope, path, item->depth);
+        if (!match)
+            return 0;
+        item->included = (match == 2);
+    }
+
+    return 1;
+}
+
+static int crawlCache_cb(const char* fName, const fhandle3* handle,
+                         const fattr3* attribs, void* userData)
+{
+    crawl_cb_args_t* args = (crawl_cb_args_t*) userData;
+    crawler_t* crawler = args->worker->crawler;
+    const crawl_scope_t* scope = &crawler->scope;
+
+    const int isDotOrDotDot = (fName[0] == '.')
+        && (fName[1] == '\0' || (fName[1] == '.' && fName[2] == '\0'));
+
+    pthread_mutex_lock(&crawler->cache_lock);
+
+    if (!isDotOrDotDot)
+    {
+        // the budgets leave the directory unlisted, the rest of it
+        // is read on first use
+        if ((scope->max_dir_entries && args->n_entries >= scope->max_dir_entries)
+         || (scope->max_entries && crawler->n_entries >= scope->max_entries))
+        {
+            crawler->out_of_budget |=
+                (scope->max_entries && crawler->n_entries >= scope->max_entries);
+            args->truncated = 1;
+            pthread_mutex_unlock(&crawler->cache_lock);
+            return 0;
+        }
+        args->n_entries++;
+        crawler->n_entries++;
+    }
+
+    populateCache_cb(fName, handle, attribs, &args->populate);
+
+    // new subdirectories come back unlisted, those are ours to crawl
+    cached_dir_t* parentDir = args->populate.parentDir->cached_dir;
+    meta_data_entry_t* entry = parentDir ?
+        LookupInDirectory(crawler->cache, parentDir, fName, strlen(fName)) : 0;
+    int descend = (entry && handle
+        && entry->type == ENTRY_TYPE_DIRECTORY
+        && (entry->flags & ENTRY_FLAG_UNLISTED));
+
+    crawl_item_t item = {0};
+    if (descend)
+        descend = InCrawlScope(scope, crawler->cache, args->item, fName, &item);
+
+    // the budget is taken right away so the queue can't outgrow it
+    // without attributes the size is unknown, those are read on first use
+    int prefetch = (attribs && entry && handle
+        && entry->type == ENTRY_TYPE_FILE
+        && attribs->size && attribs->size <= crawler->prefetch_max_size
+        && attribs->size <= crawler->prefetch_budget
+        && entry->cached_file->data_capacity < attribs->size);
+    if (prefetch)
+        crawler->prefetch_budget -= attribs->size;
+
+    pthread_mutex_unlock(&crawler->cache_lock);
+
+    if (prefetch)
+    {
+        prefetch_item_t file = { entry, *handle, (uint32_t)attribs->size };
+        PushPrefetch(crawler, &file);
+    }
+
+    if (descend)
+    {
+        item.dir = entry;
+        item.handle = *handle;
+        // without attributes the mtime stays 0, a checkpointed cookie
+        // won't match it and the directory is listed again from the start
+        if (attribs)
+            item.mtime = attribs->mtime;
+        PushWork(args->worker, &item);
+    }
+
+    return 1;
+}
+
+/// lists worker->current page by page
+/// every page is one step inside the frontier, so a checkpoint
+/// never sees children of a page without the cookie after it
+static void CrawlDirectory(crawl_worker_t* worker)
+{
+    crawler_t* crawler = worker->crawler;
+    crawl_item_t* item = &worker->current;
+
+    pthread_mutex_lock(&crawler->cache_lock);
+    int out_of_budget = crawler->out_of_budget;
+    pthread_mutex_unlock(&crawler->cache_lock);
+    if (out_of_budget)
+        return;
+
+    SOCKET nfs_fd = AcquireConnection(crawler);
+    if (nfs_fd == INVALID_SOCKET)
+        return;
+
+    // a listing resumed from a checkpoint misses the entries before its
+    // cookie, the directory stays unlisted and gets completed on first use
+    const int resumed = (item->cookie != 0);
+    crawl_cb_args_t args = { worker, item, { crawler->cache, item->dir }, 0, 0 };
+    readdir_window_t window = ReaddirWindow(crawler->cache);
+
+    int status;
+    do {
+        EnterFrontier(crawler);
+        status = nfs_readdirplus(nfs_fd, &item->handle
+              , &item->cookie, &item->verifier
+              , &window, crawlCache_cb, &args
+        );
+        LeaveFrontier(crawler);
+    } while (status > 0);
+
+    if (status < 0)
+        DiscardConnection(crawler, nfs_fd);
+    else
+        ReleaseConnection(crawler, nfs_fd);
+
+    // an error leaves the directory unlisted
+    // so it gets listed again on first use
+    const int complete = (status == 0);
+    if (complete && !resumed && !args.truncated)
+    {
+        pthread_mutex_lock(&crawler->cache_lock);
+        item->dir->flags &= ~ENTRY_FLAG_UNLISTED;
+        pthread_mutex_unlock(&crawler->cache_lock);
+    }
+}
+
+/// reads a small file into the cache, the budget for it is taken already
+static void PrefetchFile(crawler_t* crawler, const prefetch_item_t* item)
+{
+    SOCKET nfs_fd = AcquireConnection(crawler);
+    if (nfs_fd == INVALID_SOCKET)
+        return;
+
+    uint8_t* buffer = (uint8_t*) malloc(item->size);
+    uint32_t read = 0;
+    fattr3 attribs = {NF3NON};
+    int64_t n = 0;
+    while (read < item->size)
+    {
+        uint32_t chunk = item->size - read;
+        // the transfer size FSINFO reported, rtmax never changes during the crawl
+        if (chunk > crawler->cache->rtmax)
+            chunk = crawler->cache->rtmax;
+        n = nfs_read(nfs_fd, &item->handle, buffer + read,
+                     chunk, read, &attribs);
+        if (n <= 0)
+            break;
+        read += (uint32_t)n;
+    }
+
+    if (n < 0)
+        DiscardConnection(crawler, nfs_fd);
+    else
+        ReleaseConnection(crawler, nfs_fd);
+
+    pthread_mutex_lock(&crawler->cache_lock);
+    meta_data_entry_t* file = item->file;
+    fhandle3 handle = ptrToHandle(crawler->cache, file->handle);
+    // a file which changed since it was listed is read on first use
+    if (read == item->size
+     && file->type == ENTRY_TYPE_FILE
+     && !memcmp(&handle, &item->handle, sizeof(fhandle3))
+     && !ApplyPostOpAttribs(crawler->cache, file, &attribs, (uint32_t)time(0))
+     && file->cached_file->attribs.size == item->size)
+    {
+        FillFileBlocks(file->cached_file, buffer, read, 0);
+    }
+    else
+    {
+        crawler->prefetch_budget += item->size;
+    }
+    pthread_mutex_unlock(&crawler->cache_lock);
+
+    free(buffer);
+}
+
+static void* CrawlWorker(void* arg)
+{
+    crawl_worker_t* self = (crawl_worker_t*) arg;
+    crawler_t* crawler = self->crawler;
+
+    for(;;)
+    {
+        pthread_mutex_lock(&crawler->idle_lock);
+        uint32_t generation = crawler->generation;
+        pthread_mutex_unlock(&crawler->idle_lock);
+
+        EnterFrontier(crawler);
+        self->busy = (Deque_Pop(&self->deque, &self->current)
+                   || StealWork(self, &self->current));
+        LeaveFrontier(crawler);
+
+        if (self->busy)
+        {
+            CrawlDirectory(self);
+
+            EnterFrontier(crawler);
+            self->busy = 0;
+            LeaveFrontier(crawler);
+
+            pthread_mutex_lock(&crawler->idle_lock);
+            if (--crawler->pending == 0)
+                pthread_cond_broadcast(&crawler->idle_cond);
+            pthread_mutex_unlock(&crawler->idle_lock);
+
+            MaybeCheckpoint(crawler);
+            continue;
+        }
+
+        // directories first, they might bring more small files
+        prefetch_item_t file;
+        if (PopPrefetch(crawler, &file))
+        {
+            PrefetchFile(crawler, &file);
+
+            pthread_mutex_lock(&crawler->idle_lock);
+            if (--crawler->pending == 0)
+                pthread_cond_broadcast(&crawler->idle_cond);
+            pthread_mutex_unlock(&crawler->idle_lock);
+            continue;
+        }
+
+        pthread_mutex_lock(&crawler->idle_lock);
+        if (crawler->pending == 0)
+        {
+            pthread_mutex_unlock(&crawler->idle_lock);
+            break;
+        }
+        // somebody is still listing, wait for new work or for the end
+        if (generation == crawler->generation)
+            pthread_cond_wait(&crawler->idle_cond, &crawler->idle_lock);
+        pthread_mutex_unlock(&crawler->idle_lock);
+    }
+
+    return 0;
+}
+
+/// reads a checkpoint written by MaybeCheckpoint for the same export
+/// Returns: the number of items, 0 if there is no usable checkpoint
+static uint32_t ReadCheckpoint(cache_t* cache, const char* checkpoint_path,
+                               crawl_item_t** items, char*** paths)
+{
+    uint32_t count = 0;
+    *items = 0;
+    *paths = 0;
+
+    FILE* f = fopen(checkpoint_path, "rb");
+    if (!f)
+        return 0;
+
+    char magic[8];
+    fhandle3 root;
+    if (fread(magic, 1, 8, f) != 8 || memcmp(magic, CHECKPOINT_MAGIC, 8)
+     || fread(&root, sizeof(root), 1, f) != 1
+     || memcmp(&root, &cache->rootHandle, sizeof(root))
+     || fread(&count, sizeof(count), 1, f) != 1)
+    {
+        fprintf(stderr, "Ignoring checkpoint %s\n", checkpoint_path);
+        fclose(f);
+        return 0;
+    }
+
+    *items = (crawl_item_t*) calloc(count, sizeof(crawl_item_t));
+    *paths = (char**) calloc(count, sizeof(char*));
+
+    uint32_t i;
+    for(i = 0; i < count; i++)
+    {
+        crawl_item_t* item = (*items) + i;
+        uint32_t path_length;
+        if (fread(&item->handle, sizeof(item->handle), 1, f) != 1
+         || fread(&item->cookie, sizeof(item->cookie), 1, f) != 1
+         || fread(&item->verifier, sizeof(item->verifier), 1, f) != 1
+         || fread(&item->mtime, sizeof(item->mtime), 1, f) != 1
+         || fread(&item->depth, sizeof(item->depth), 1, f) != 1
+         || fread(&item->included, sizeof(item->included), 1, f) != 1
+         || fread(&path_length, sizeof(path_length), 1, f) != 1
+         || path_length >= 4096)
+            break;
+
+        (*paths)[i] = (char*) malloc(path_length + 1);
+        if (fread((*paths)[i], 1, path_length, f) != path_length)
+            break;
+        (*paths)[i][path_length] = '\0';
+    }
+    fclose(f);
+
+    // a truncated checkpoint still resumes what it has
+    if (i < count)
+    {
+        free((*paths)[i]);
+        count = i;
+    }
+
+    return count;
+}
+
+/// turns the checkpointed frontier back into crawl items
+/// the directories above the frontier are created unlisted
+/// since the checkpoint only knows what was still to do
+static uint32_t ResumeCheckpoint(cache_t* cache, crawl_worker_t* workers,
+                                 uint32_t n_workers, const char* checkpoint_path)
+{
+    crawl_item_t* items;
+    char** paths;
+    uint32_t count = ReadCheckpoint(cache, checkpoint_path, &items, &paths);
+    if (!count)
+    {
+        free(items);
+        free(paths);
+        return 0;
+    }
+
+    // without a connection nothing can be checked, crawl from the root
+    SOCKET nfs_fd = nfs_connect_server();
+    if (nfs_fd == INVALID_SOCKET)
+    {
+        for(uint32_t i = 0; i < count; i++)
+            free(paths[i]);
+        free(items);
+        free(paths);
+        return 0;
+    }
+    uint32_t resumed = 0;
+
+    cache->root->flags |= ENTRY_FLAG_UNLISTED;
+
+    for(uint32_t i = 0; i < count; i++)
+    {
+        crawl_item_t* item = items + i;
+        size_t path_length = strlen(paths[i]);
+
+        meta_data_entry_t* dir = (path_length == 1) ? cache->root
+            : nfs_lookup_path(cache, nfs_fd, paths[i], path_length);
+        fhandle3 handle;
+        if (dir)
+            handle = ptrToHandle(cache, dir->handle);
+
+        if (!dir || dir->type != ENTRY_TYPE_DIRECTORY
+         || memcmp(&handle, &item->handle, sizeof(fhandle3)))
+        {
+            // gone or replaced, whatever is there now is listed on first use
+            printf("Dropping %s from the checkpoint\n", paths[i]);
+            free(paths[i]);
+            continue;
+        }
+
+        if (item->cookie)
+        {
+            fattr3 attribs;
+            if (nfs_getattr(nfs_fd, &item->handle, &attribs) != NFS3ERR_OK)
+            {
+                free(paths[i]);
+                continue;
+            }
+
+            // the cookie is only meaningful for the directory as it was
+            if (attribs.mtime.seconds != item->mtime.seconds
+             || attribs.mtime.nseconds != item->mtime.nseconds)
+            {
+                item->cookie = 0;
+                item->verifier = 0;
+                item->mtime = attribs.mtime;
+            }
+        }
+
+        item->dir = dir;
+        dir->flags |= ENTRY_FLAG_UNLISTED;
+        PushWork(workers + (resumed++ % n_workers), item);
+        free(paths[i]);
+    }
+
+    closesocket(nfs_fd);
+    free(items);
+    free(paths);
+
+    return resumed;
+}
+
+/// lists dir and everything below it on a pool of worker threads
+static void CrawlTree(cache_t* cache, meta_data_entry_t* dir, const fhandle3* handle)
+{
+    crawler_t crawler;
+    memset(&crawler, 0, sizeof(crawler));
+
+    crawler.cache = cache;
+    crawler.n_workers = mount_options.crawl_threads ? mount_options.crawl_threads : 1;
+    crawler.max_connections = mount_options.crawl_connections
+                            ? mount_options.crawl_connections : crawler.n_workers;
+    crawler.checkpoint_path = mount_options.checkpoint_path;
+    crawler.checkpoint_interval = mount_options.checkpoint_interval;
+    crawler.last_checkpoint = time(0);
+    InitCrawlScope(&crawler.scope, &mount_options);
+    crawler.prefetch_max_size = mount_options.prefetch_max_size;
+    crawler.prefetch_budget = (uint64_t)mount_options.prefetch_budget << 20;
+
+    pthread_mutex_init(&crawler.cache_lock, 0);
+    pthread_mutex_init(&crawler.pool_lock, 0);
+    pthread_cond_init(&crawler.pool_cond, 0);
+    pthread_mutex_init(&crawler.idle_lock, 0);
+    pthread_cond_init(&crawler.idle_cond, 0);
+    pthread_mutex_init(&crawler.prefetch_lock, 0);
+
+    crawler.free_connections = (SOCKET*)
+        calloc(crawler.max_connections, sizeof(SOCKET));
+    crawler.workers = (crawl_worker_t*)
+        calloc(crawler.n_workers, sizeof(crawl_worker_t));
+
+    for(uint32_t i = 0; i < crawler.n_workers; i++)
+    {
+        crawler.workers[i].crawler = &crawler;
+        crawler.workers[i].index = i;
+        pthread_mutex_init(&crawler.workers[i].deque.lock, 0);
+    }
+
+    uint32_t resumed = 0;
+    if (crawler.checkpoint_path)
+    {
+        resumed = ResumeCheckpoint(cache, crawler.workers,
+                                   crawler.n_workers, crawler.checkpoint_path);
+        if (resumed)
+            printf("Resuming crawl of %u directories\n", resumed);
+    }
+
+    if (!resumed)
+    {
+        crawl_item_t root = {0};
+        root.dir = dir;
+        root.handle = *handle;
+        root.included = (crawler.scope.n_include == 0);
+        if (crawler.checkpoint_path)
+        {
+            // without the mtime a checkpoint lists the root again
+            SOCKET nfs_fd = nfs_connect_server();
+            fattr3 attribs;
+            if (nfs_fd != INVALID_SOCKET)
+            {
+                if (nfs_getattr(nfs_fd, handle, &attribs) == NFS3ERR_OK)
+                    root.mtime = attribs.mtime;
+                closesocket(nfs_fd);
+            }
+        }
+        dir->flags |= ENTRY_FLAG_UNLISTED;
+        PushWork(crawler.workers, &root);
+    }
+
+    for(uint32_t i = 0; i < crawler.n_workers; i++)
+    {
+        pthread_create(&crawler.workers[i].thread, 0,
+                       CrawlWorker, crawler.workers + i);
+    }
+
+    for(uint32_t i = 0; i < crawler.n_workers; i++)
+    {
+        pthread_join(crawler.workers[i].thread, 0);
+    }
+
+    // only now, a worker on its way out might still try to steal
+    for(uint32_t i = 0; i < crawler.n_workers; i++)
+    {
+        pthread_mutex_destroy(&crawler.workers[i].deque.lock);
+        free(crawler.workers[i].deque.items);
+    }
+
+    for(uint32_t i = 0; i < crawler.n_free_connections; i++)
+    {
+        closesocket(crawler.free_connections[i]);
+    }
+
+    // the crawl got through, there is nothing left to resume
+    if (crawler.checkpoint_path)
+        remove(crawler.checkpoint_path);
+
+    free(crawler.workers);
+    free(crawler.free_connections);
+    free(crawler.prefetch);
+    FreeCrawlScope(&crawler.scope);
+
+    pthread_mutex_destroy(&crawler.prefetch_lock);
+    pthread_cond_destroy(&crawler.idle_cond);
+    pthread_mutex_destroy(&crawler.idle_lock);
+    pthread_cond_destroy(&crawler.pool_cond);
+    pthread_mutex_destroy(&crawler.pool_lock);
+    pthread_mutex_destroy(&crawler.cache_lock);
+}
+
+int nfs_connect_server(void)
+{
+    return connect_name(mount_options.hostname, "2049");
+}
+
+void nfs_list_directory(cache_t* cache, int nfs_fd, meta_data_entry_t* dir)
+{
+    assert(dir->type == ENTRY_TYPE_DIRECTORY);
+
+    fhandle3 handle = ptrToHandle(cache, dir->handle);
+    cookie3 cookie = 0;
+    cookie3 verifier = 0;
+    // one level only, subdirectories come back unlisted
+    populate_cache_cb_args_t args = {cache, dir};
+    readdir_window_t window = ReaddirWindow(cache);
+
+    // a listing of a known directory is merged into what we have,
+    // whatever it doesn't return anymore is gone on the server
+    if (dir->cached_dir)
+    {
+        for(uint32_t i = 0; i < dir->cached_dir->entries_size; i++)
+            DirEntry(dir->cached_dir, i)->flags &= ~ENTRY_FLAG_LISTED;
+    }
+
+    int complete = 0;
+    for(;;) {
+        int shouldContinueReading =
+        nfs_readdirplus(nfs_fd, &handle
+              , &cookie, &verifier
+              , &window, populateCache_cb, &args
+        );
+        if (shouldContinueReading <= 0)
+        {
+            // populateCache_cb never stops early, 0 is the real end
+            complete = (shouldContinueReading == 0);
+            break;
+        }
+    }
+
+    if (!complete)
+        return;
+
+    if (dir->cached_dir)
+    {
+        for(uint32_t i = dir->cached_dir->entries_size; i--; )
+        {
+            meta_data_entry_t* entry = DirEntry(dir->cached_dir, i);
+            if (!(entry->flags & (ENTRY_FLAG_LISTED | ENTRY_FLAG_VIRTUAL)))
+                RemoveEntry(cache, dir->cached_dir, entry);
+        }
+    }
+
+    dir->flags &= ~ENTRY_FLAG_UNLISTED;
+}
+
+/// appends the listed directories below dir to dirs, parents first
+static uint32_t CollectListedDirectories(cache_t* cache, meta_data_entry_t* dir,
+                                         meta_data_entry_t*** dirs, uint32_t n,
+                                         uint32_t* capacity)
+{
+    if (n == *capacity)
+    {
+        *capacity = *capacity ? *capacity * 2 : 256;
+        *dirs = (meta_data_entry_t**)
+            realloc(*dirs, *capacity * sizeof(meta_data_entry_t*));
+    }
+    (*dirs)[n++] = dir;
+
+    for(uint32_t i = 0; i < dir->cached_dir->entries_size; i++)
+    {
+        meta_data_entry_t* entry = DirEntry(dir->cached_dir, i);
+        const char* name = toCharPtr(cache, entry->name);
+        const int isDotOrDotDot = (name[0] == '.')
+            && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'));
+
+        // unlisted directories have nothing cached which could be stale
+        if (entry->type == ENTRY_TYPE_DIRECTORY && !isDotOrDotDot
+         && !(entry->flags & ENTRY_FLAG_UNLISTED))
+        {
+            n = CollectListedDirectories(cache, entry, dirs, n, capacity);
+        }
+    }
+
+    return n;
+}
+
+uint32_t nfs_refresh(cache_t* cache, int* nfs_fd)
+{
+    if (cache->root->flags & ENTRY_FLAG_UNLISTED)
+        return 0;
+
+    meta_data_entry_t** dirs = 0;
+    uint32_t capacity = 0;
+    const uint32_t n = CollectListedDirectories(cache, cache->root, &dirs, 0, &capacity);
+
+    fhandle3* handles = (fhandle3*) malloc(n * sizeof(fhandle3));
+    fattr3* attribs = (fattr3*) malloc(n * sizeof(fattr3));
+    nfsstat3* statuses = (nfsstat3*) malloc(n * sizeof(nfsstat3));
+    uint8_t* changed = (uint8_t*) malloc(n);
+
+    for(uint32_t i = 0; i < n; i++)
+        handles[i] = ptrToHandle(cache, dirs[i]->handle);
+
+    // one round trip per NFS_PIPELINE_DEPTH directories instead of one each
+    const int broken = nfs_getattr_many(*nfs_fd, handles, n, attribs, statuses) < 0;
+    if (broken)
+    {
+        // replies still on their way would be read by the next call
+        closesocket(*nfs_fd);
+        *nfs_fd = nfs_connect_server();
+    }
+
+    const uint32_t now = (uint32_t)time(0);
+    for(uint32_t i = 0; i < n; i++)
+    {
+        changed[i] = !broken && (statuses[i] == NFS3ERR_OK)
+                  && UpdateAttribs(cache, dirs[i], &attribs[i], now);
+    }
+
+    // children first, listing a parent again may move its entries around
+    uint32_t relisted = 0;
+    for(uint32_t i = n; i-- > 0;)
+    {
+        if (changed[i])
+        {
+            nfs_list_directory(cache, *nfs_fd, dirs[i]);
+            relisted++;
+        }
+    }
+
+    free(changed);
+    free(statuses);
+    free(attribs);
+    free(handles);
+    free(dirs);
+
+    return relisted;
+}
+
+void nfs_maybe_refresh(cache_t* cache, int* nfs_fd)
+{
+    static time_t last_refresh = 0;
+
+    if (!mount_options.refresh_interval)
+        return;
+
+    time_t now = time(0);
+    if (!last_refresh)
+        last_refresh = now;
+    if (now - last_refresh < mount_options.refresh_interval)
+        return;
+
+    last_refresh = now;
+    nfs_refresh(cache, nfs_fd);
+}
+
+/// forgets what was cached about an entry which changed on the server
+static void DropStaleContent(meta_data_entry_t* entry, const fattr3* attribs)
+{
+    switch (entry->type)
+    {
+        case ENTRY_TYPE_FILE:
+            // unflushed writes win until close, like close-to-open wants
+            if (entry->cached_file->n_dirty)
+                break;
+            InvalidateFileBlocks(entry->cached_file);
+            entry->cached_file->size = attribs->size;
+        break;
+        case ENTRY_TYPE_DIRECTORY:
+            entry->flags |= ENTRY_FLAG_UNLISTED;
+        break;
+        case ENTRY_TYPE_SYMLINK:
+            // the target goes by the ctime already
+            entry->cached_file->size = attribs->size;
+        break;
+    }
+}
+
+int nfs_revalidate(cache_t* cache, int nfs_fd, meta_data_entry_t* entry)
+{
+    cached_attribs_t* cached = EntryAttribs(entry);
+    const uint32_t now = (uint32_t)time(0);
+    if (!cached || AttribsValid(cached, now))
+        return 0;
+
+    fhandle3 handle = ptrToHandle(cache, entry->handle);
+    fattr3 attribs;
+    nfsstat3 status = nfs_getattr(nfs_fd, &handle, &attribs);
+    if (status == NFS3ERR_STALE || status == NFS3ERR_NOENT)
+        return -ENOENT;
+    else if (status != NFS3ERR_OK)
+        return -EIO;
+
+    if (UpdateAttribs(cache, entry, &attribs, now))
+        DropStaleContent(entry, &attribs);
+
+    return 0;
+}
+
+int nfs_open_file(cache_t* cache, int nfs_fd, meta_data_entry_t* file,
+                  uint32_t window)
+{
+    cached_attribs_t* cached = EntryAttribs(file);
+    const uint32_t now = (uint32_t)time(0);
+    if (!cached)
+        return 0;
+    if (cached->fetched_at && now - cached->fetched_at < window)
+        return 1;
+
+    fhandle3 handle = ptrToHandle(cache, file->handle);
+    fattr3 attribs;
+    nfsstat3 status = nfs_getattr(nfs_fd, &handle, &attribs);
+    if (status == NFS3ERR_STALE || status == NFS3ERR_NOENT)
+        return -ENOENT;
+    else if (status != NFS3ERR_OK)
+        return -EIO;
+
+    if (UpdateAttribs(cache, file, &attribs, now))
+    {
+        DropStaleContent(file, &attribs);
+        return 0;
+    }
+
+    return 1;
+}
+
+int nfs_flush_file(cache_t* cache, int nfs_fd, meta_data_entry_t* file)
+{
+    cached_file_t* cached = file->cached_file;
+    if (!cached->n_dirty)
+        return 0;
+
+    fhandle3 handle = ptrToHandle(cache, file->handle);
+    int foreign = 0;
+
+    for(uint32_t i = 0; i < cached->n_dirty; i++)
+    {
+        const file_range_t range = cached->dirty[i];
+        for(uint32_t done = 0; done < range.size;)
+        {
+            uint32_t chunk = range.size - done;
+            if (chunk > cache->wtmax)
+                chunk = cache->wtmax;
+
+            wcc_data wcc;
+            int64_t written = nfs_write(nfs_fd, &handle,
+                (const uint8_t*)cached->data + range.offset + done,
+                chunk, range.offset + done, &wcc);
+            if (written <= 0)
+                return -EIO;
+
+            foreign |= ApplyWcc(cache, file, &wcc, (uint32_t)time(0));
+            done += (uint32_t)written;
+        }
+    }
+
+    ClearDirtyRanges(cached);
+
+    // somebody else wrote to the file as well, our blocks are stale
+    if (foreign)
+    {
+        InvalidateFileBlocks(cached);
+        cached->size = cached->attribs.size;
+    }
+
+    return 0;
+}
+
+int nfs_check_access(cache_t* cache, int nfs_fd, meta_data_entry_t* entry,
+                     uint32_t uid, uint32_t gid,
+                     uint32_t n_gids, const uint32_t gids[], uint32_t access)
+{
+    // fresh attributes tell whether a cached mask still applies
+    int res = nfs_revalidate(cache, nfs_fd, entry);
+    if (res)
+        return res;
+
+    const uint32_t now = (uint32_t)time(0);
+    uint32_t granted;
+    if (!LookupAccess(cache, entry, uid, gid, now, &granted))
+    {
+        fhandle3 handle = ptrToHandle(cache, entry->handle);
+        fattr3 attribs;
+        // asking for everything answers every later check as well
+        nfsstat3 status = nfs_access(nfs_fd, &handle, uid, gid, n_gids, gids,
+                                     ACCESS3_ALL, &granted, &attribs);
+        if (status == NFS3ERR_STALE || status == NFS3ERR_NOENT)
+            return -ENOENT;
+        else if (status != NFS3ERR_OK)
+            return -EIO;
+
+        if (ApplyPostOpAttribs(cache, entry, &attribs, now))
+            DropStaleContent(entry, &attribs);
+        // the groups beyond the credential's limit might have granted
+        // more, such an answer is only good for this call
+        if (n_gids <= AUTH_UNIX_MAX_GIDS)
+            AddAccess(cache, entry, uid, gid, granted, now);
+    }
+
+    return ((granted & access) == access) ? 0 : -EACCES;
+}
+
+int nfs_read_link(cache_t* cache, int nfs_fd, meta_data_entry_t* link,
+                  const char** target)
+{
+    int res = nfs_revalidate(cache, nfs_fd, link);
+    if (res)
+        return res;
+
+    *target = LinkTarget(cache, link);
+    if (*target)
+        return 0;
+
+    const uint32_t now = (uint32_t)time(0);
+    fhandle3 handle = ptrToHandle(cache, link->handle);
+    char buffer[1024];
+    uint32_t length;
+    fattr3 attribs;
+    nfsstat3 status = nfs_readlink(nfs_fd, &handle, buffer, &length, &attribs);
+    if (status == NFS3ERR_STALE || status == NFS3ERR_NOENT)
+        return -ENOENT;
+    else if (status == NFS3ERR_INVAL)
+        return -EINVAL;
+    else if (status != NFS3ERR_OK)
+        return -EIO;
+
+    if (ApplyPostOpAttribs(cache, link, &attribs, now))
+        DropStaleContent(link, &attribs);
+
+    SetLinkTarget(cache, link, buffer, length);
+    *target = toCharPtr(cache, link->cached_file->link_target);
+    if (!*target)
+        *target = "";
+
+    return 0;
+}
+
+static meta_data_entry_t* LookupOnServer(cache_t* cache, int nfs_fd,
+                                         meta_data_entry_t* dir,
+                                         const char* name, size_t name_length)
+{
+    char name_buffer[1024];
+    if (name_length >= sizeof(name_buffer))
+        return 0;
+
+    memcpy(name_buffer, name, name_length);
+    name_buffer[name_length] = '\0';
+
+    fhandle3 dirHandle = ptrToHandle(cache, dir->handle);
+    fhandle3 handle;
+    fattr3 attribs;
+
+    nfsstat3 status = nfs_lookup(nfs_fd, &dirHandle, name_buffer, name_length,
+                                 &handle, &attribs);
+    if (status == NFS3ERR_NOENT)
+        AddNegativeEntry(cache, dir, name, name_length);
+    if (status != NFS3ERR_OK)
+        return 0;
+
+    populate_cache_cb_args_t args = {cache, dir};
+    populateCache_cb(name_buffer, &handle,
+                     attribs.type != NF3NON ? &attribs : 0, &args);
+
+    return LookupInDirectory(cache, dir->cached_dir, name_buffer, name_length);
+}
+
+meta_data_entry_t* nfs_lookup_path(cache_t* cache, int nfs_fd,
+                                   const char* full_path, size_t path_length)
+{
+    meta_data_entry_t* result = LookupPath(cache, full_path, path_length);
+    if (result)
+        return result;
+
+    // walk the path and ask the server for every name
+    // which is missing from a directory that was not listed yet
+    meta_data_entry_t* current = cache->root;
+    const char* begin_segment = full_path + 1;
+    const char* end = full_path + path_length;
+
+    while (begin_segment < end)
+    {
+        const char* end_segment =
+            (const char*)memchr(begin_segment, '/', end - begin_segment);
+        if (!end_segment)
+            end_segment = end;
+        size_t segment_length = end_segment - begin_segment;
+
+        if (current->type != ENTRY_TYPE_DIRECTORY)
+            return 0;
+
+        meta_data_entry_t* next =
+            LookupInDirectory(cache, current->cached_dir,
+                              begin_segment, segment_length);
+        if (!next)
+        {
+            // a miss is only as good as the attributes of the directory,
+            // if it changed it comes back unlisted and its negative
+            // entries no longer match its mtime
+            if (nfs_revalidate(cache, nfs_fd, current))
+                return 0;
+
+            if ((current->flags & ENTRY_FLAG_UNLISTED)
+             && !IsNegativeEntry(cache, current, begin_segment, segment_length))
+            {
+                next = LookupOnServer(cache, nfs_fd, current,
+                                      begin_segment, segment_length);
+            }
+        }
+        if (!next)
+            return 0;
+
+        current = next;
+        begin_segment = end_segment + 1;
+    }
+
+    return (current != cache->root ? current : 0);
+}
+
+extern int nfs_init_cache(cache_t* dirCache, const nfs_mount_options_t* options)
 {
 #ifdef _WIN32
 	WSADATA  wsaData;
 	WSAStartup(MAKEWORD(2,2), &wsaData);
 #endif
-    char* hostname = "192.168.178.26";
-    if (argc == 2)
-        hostname = argv[1];
+    mount_options = *options;
+    const char* hostname = options->hostname;
 
     /* Create socket. */
     int sock = socket(AF_INET, SOCK_STREAM, 0);
@@ -55,38 +1486,43 @@ extern int nfs_init_cache(cache_t* dirCache, int argc, char* argv[])
     int mountd_fd = connect_name(hostname, port_str);
     assert(mountd_fd != -1);
 
-    fhandle3 fh = mountd_mnt(mountd_fd, "/nfs/git");
+    fhandle3 fh = mountd_mnt(mountd_fd, options->export_path);
     printFileHandle(&fh);
 
-    int nfs_fd = connect_name("192.168.178.26", "2049");
-    cookie3 cookie = 0;
-    cookie3 verifier = 0;
-/*
-    read_more = nfs_readdir(nfs_fd, &fh
-          , &cookie, &verifier
-          , myCallBack
-    );
-*/
-
     InitCache(dirCache);
+    if (options->acregmin)
+        dirCache->acregmin = options->acregmin;
+    if (options->acregmax)
+        dirCache->acregmax = options->acregmax;
+    if (options->acdirmin)
+        dirCache->acdirmin = options->acdirmin;
+    if (options->acdirmax)
+        dirCache->acdirmax = options->acdirmax;
+    InitNegativeCache(dirCache, options->negative_entries);
+    InitAccessCache(dirCache, options->access_entries, options->access_timeout);
     dirCache->rootHandle = fh;
-    populate_cache_cb_args_t args = {dirCache, dirCache->root};
+    dirCache->root->handle = handleToPtr(dirCache, &fh);
 
-    for(;;) {
-        cookie3 old_cookie = cookie;
-        int shouldContinueReading =
-        nfs_readdirplus(nfs_fd, &fh
-              , &cookie, &verifier
-              , populateCache_cb, &args
-        );
-        if (!shouldContinueReading)
-            break;
+    {
+        int nfs_fd = nfs_connect_server();
+        fsinfo3 fsinfo;
+        if (nfs_fsinfo(nfs_fd, &fh, &fsinfo) == NFS3ERR_OK)
+            ApplyFsinfo(dirCache, &fsinfo);
+        closesocket(nfs_fd);
     }
 
-    cached_dir_t root = *dirCache->root->cached_dir;
-    meta_data_entry_t* one_past_last_entry =
-        root.entries + root.entries_size;
+    if (options->lazy)
+    {
+        int nfs_fd = nfs_connect_server();
+        nfs_list_directory(dirCache, nfs_fd, dirCache->root);
+        closesocket(nfs_fd);
+    }
+    else
+    {
+        CrawlTree(dirCache, dirCache->root, &fh);
+    }
 
     // TODO unmount on shutdown of filesystem
-    // mountd_umnt(mountd_fd, "/nfs/git");
+    // mountd_umnt(mountd_fd, options->export_path);
+    return 0;
 }
@@ -0,0 +1,118 @@
+#ifndef _MICRONFS_GLUE_H_
+#define _MICRONFS_GLUE_H_
+
+#include <stddef.h>
+#include "../cache/cached_tree.h"
+
+typedef struct nfs_mount_options_t
+{
+    const char* hostname;
+    const char* export_path;
+
+    /// only list the root at mount time
+    /// everything else is listed or looked up on first use
+    int lazy;
+
+    /// how many threads crawl the export at mount time
+    unsigned crawl_threads;
+    /// upper bound for the connections the crawl threads share
+    unsigned crawl_connections;
+
+    /// file the crawl frontier is saved to every checkpoint_interval
+    /// seconds, an interrupted crawl resumes from it on the next mount
+    const char* checkpoint_path;
+    unsigned checkpoint_interval;
+
+    /// crawl scope, everything outside is listed on first use
+    /// colon separated globs, an exclude without '/' matches directory
+    /// names anywhere, all others match paths from the export root
+    const char* include;
+    const char* exclude;
+    unsigned max_depth; /// 0 for no limit
+    unsigned max_dir_entries; /// per directory, 0 for no limit
+    unsigned max_entries; /// for the whole crawl, 0 for no limit
+
+    /// attribute cache timeouts in seconds, 0 keeps the default
+    unsigned acregmin;
+    unsigned acregmax;
+    unsigned acdirmin;
+    unsigned acdirmax;
+
+    /// seconds between passes which check all listed directories
+    /// for changes, 0 to only revalidate what gets used
+    unsigned refresh_interval;
+
+    /// slots of the cache for names the server reported missing
+    unsigned negative_entries;
+
+    /// slots of the cache for ACCESS results and how many seconds
+    /// they are trusted, a timeout of 0 asks the server on every open
+    unsigned access_entries;
+    unsigned access_timeout;
+
+    /// files up to prefetch_max_size bytes are read during the crawl,
+    /// until prefetch_budget MiB are used, 0 to not prefetch
+    unsigned prefetch_max_size;
+    unsigned prefetch_budget;
+
+    /// seconds after a GETATTR in which an open trusts the cached
+    /// attributes, 0 for strict close-to-open
+    unsigned open_window;
+} nfs_mount_options_t;
+
+int nfs_init_cache(cache_t* dirCache, const nfs_mount_options_t* options);
+
+/// opens a new connection to the nfs server of the mount
+int nfs_connect_server(void);
+
+/// like LookupPath but resolves names the cache has not seen yet
+/// with LOOKUP calls in directories which were not listed yet
+meta_data_entry_t* nfs_lookup_path(cache_t* cache, int nfs_fd,
+                                   const char* full_path, size_t path_length);
+
+/// reads all entries of dir into the cache
+/// entries which were cached before but are not listed anymore are removed
+void nfs_list_directory(cache_t* cache, int nfs_fd, meta_data_entry_t* dir);
+
+/// refreshes the attributes of entry with GETATTR once they timed out
+/// a file which changed loses its cached content
+/// a directory which changed is listed again on next use
+/// Returns: 0 or a negative errno
+int nfs_revalidate(cache_t* cache, int nfs_fd, meta_data_entry_t* entry);
+
+/// the open half of close-to-open, GETATTRs file unless its attributes
+/// are younger than window seconds, a change drops the cached content
+/// Returns: 1 if the cached content is still good, 0 if it was
+///          dropped or a negative errno
+int nfs_open_file(cache_t* cache, int nfs_fd, meta_data_entry_t* file,
+                  uint32_t window);
+
+/// the close half, writes the dirty ranges of file back
+/// Returns: 0 or a negative errno
+int nfs_flush_file(cache_t* cache, int nfs_fd, meta_data_entry_t* file);
+
+/// checks the ACCESS3_* bits in access for uid/gid with ACCESS
+/// unless the server already answered for the same mode and owner
+/// gids are the supplementary groups of the caller, n_gids may be more
+/// than AUTH_UNIX_MAX_GIDS if they were cut, the answer isn't cached then
+/// Returns: 0, -EACCES or another negative errno
+int nfs_check_access(cache_t* cache, int nfs_fd, meta_data_entry_t* entry,
+                     uint32_t uid, uint32_t gid,
+                     uint32_t n_gids, const uint32_t gids[], uint32_t access);
+
+/// resolves a symlink, READLINK is only called when the ctime of
+/// the link changed since its target was read
+/// Returns: 0 or a negative errno, *target stays valid with the cache
+int nfs_read_link(cache_t* cache, int nfs_fd, meta_data_entry_t* link,
+                  const char** target);
+
+/// GETATTRs every listed directory and lists the ones again whose
+/// mtime or ctime changed, merging the new listing into the cache
+/// *nfs_fd is replaced by a new connection if the old one failed
+/// Returns: how many directories were listed again
+uint32_t nfs_refresh(cache_t* cache, int* nfs_fd);
+
+/// runs nfs_refresh if the refresh interval passed since the last one
+void nfs_maybe_refresh(cache_t* cache, int* nfs_fd);
+
+#endif
@@ -73,6 +73,19 @@ typedef enum stable_how {
     FILE_SYNC = 2
 } stable_how;
 
+typedef enum access3 {
+    ACCESS3_READ    = 0x0001,
+    ACCESS3_LOOKUP  = 0x0002,
+    ACCESS3_MODIFY  = 0x0004,
+    ACCESS3_EXTEND  = 0x0008,
+    ACCESS3_DELETE  = 0x0010,
+    ACCESS3_EXECUTE = 0x0020,
+    ACCESS3_ALL     = 0x003f
+} access3;
+
+/// AUTH_UNIX credentials carry at most 16 supplementary groups
+#define AUTH_UNIX_MAX_GIDS 16
+
 typedef enum createmode3 {
     UNCHECKED = 0,
     GUARDED   = 1,
@@ -147,8 +160,12 @@ typedef struct fattr3 {
     nfstime3   ctime;
 } fattr3;
 
+#define NFS3_FHSIZE 64
+
+/// handle[length] and after are 0, so handles compare with memcmp
 typedef struct fhandle3 {
-    uint8_t handle[64];
+    uint8_t handle[NFS3_FHSIZE];
+    uint32_t length; /// in bytes, as the server sent it
 } fhandle3;
 
 typedef enum sattr_field {
@@ -177,5 +194,26 @@ typedef struct wcc_attr {
     nfstime3  ctime;
 } wcc_attr;
 
+/// attributes before and after a change, either may be missing
+typedef struct wcc_data {
+    uint32_t  has_before;
+    uint32_t  has_after;
+    wcc_attr  before;
+    fattr3    after;
+} wcc_data;
+
+typedef struct fsinfo3 {
+    uint32_t  rtmax;
+    uint32_t  rtpref;
+    uint32_t  rtmult;
+    uint32_t  wtmax;
+    uint32_t  wtpref;
+    uint32_t  wtmult;
+    uint32_t  dtpref;
+    size3     maxfilesize;
+    nfstime3  time_delta;
+    uint32_t  properties;
+} fsinfo3;
+
 #pragma pack(pop)
 #endif
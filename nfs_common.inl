@@ -35,6 +35,7 @@
 #include <sys/stat.h>
 #include <assert.h>
 #include <errno.h>
+#include <time.h>
 
 struct sockaddr_in server;
 struct sockaddr_in m_client;
@@ -97,84 +98,129 @@ void PushUnixAuthN(RPCSerializer* self)
 #define MOUNT_EXPORT_PROCEDURE       5
 
 #define NFS_PROGRAM             100003
+#define NFS_GETATTR_PROCEDURE        1
+#define NFS_LOOKUP_PROCEDURE         3
+#define NFS_ACCESS_PROCEDURE         4
+#define NFS_READLINK_PROCEDURE       5
 #define NFS_READ_PROCEDURE           6
 #define NFS_WRITE_PROCEDURE          7
 #define NFS_CREATE_PROCEDURE         8
 #define NFS_MKNOD_PROCEDURE         11
 #define NFS_READDIR_PROCEDURE       16
 #define NFS_READDIRPLUS_PROCEDURE   17
+#define NFS_FSINFO_PROCEDURE        19
 #define MESSAGE_TYPE_CALL 0
 #define PROTO_TCP 6
 
 
 void InitCache(cache_t* cache)
 {
+    // crawl threads hash names and handles, the crc32c code of this file
+    // and of cached_tree.c is picked before they start
+    crc32c_init();
+    InitCacheCrc32c();
+
+    // enough for a small export, bigger ones grow the arenas
     uint32_t initial_name_storage_capacity = 65536;
-    uint32_t initial_name_nodes_capacity = 4096;
-    uint32_t initial_files_capacity = 16384;
+    uint32_t initial_name_slots = 8192;
+    uint32_t initial_files_capacity = 1024;
 
-    uint32_t initial_metadata_nodes = 16384 * 8;
-    uint32_t initial_dir_nodes = 2048;
-    uint32_t initial_toc_capacity = 2048;
+    uint32_t initial_metadata_nodes = 4096;
+    uint32_t initial_dir_nodes = 256;
+    uint32_t initial_toc_capacity = 256;
     uint32_t initial_limb_capacity = 16384;
-
-    uint8_t* cache_memory = (uint8_t*) malloc(
-        sizeof(cache_t) + initial_name_storage_capacity
-                        + (initial_name_nodes_capacity *
-                            sizeof(name_cache_node_t)));
-
-    toc_entry_t* toc_mem = (toc_entry_t*) calloc(
-        initial_toc_capacity, sizeof(toc_entry_t));
-
-    name_cache_node_t* tree_mem = (name_cache_node_t*)
-                                (cache_memory + sizeof(cache_t)
-                                + initial_name_storage_capacity);
-
-    meta_data_entry_t* meta_mem = (meta_data_entry_t*) calloc(
-        initial_metadata_nodes , sizeof(meta_data_entry_t));
-
-    cached_dir_t* dirs_mem = (cached_dir_t*)calloc(
-        initial_dir_nodes, sizeof(cached_dir_t));
-
-    uint32_t* limbs_mem = (uint32_t*) calloc(
-        initial_limb_capacity, sizeof(uint32_t));
-
-    cached_file_t* files_mem = (cached_file_t*)
-        calloc(initial_files_capacity, sizeof(cached_file_t));
-
-
-    cache->toc_entries = toc_mem;
-    cache->root = meta_mem++;
+    uint32_t initial_handle_slots = 4096;
+
+    // only the initial capacities are backed by memory, the arenas
+    // grow in place up to the CACHE_MAX_* limits
+    cache->toc_entries = (toc_entry_t*) ReserveArena(
+        CACHE_MAX_TOC, sizeof(toc_entry_t), initial_toc_capacity);
+    // twice the slots keeps the probe sequences short
+    uint32_t* toc_hash_mem = (uint32_t*) calloc(
+        initial_toc_capacity * 2, sizeof(uint32_t));
+
+    cache->root = (meta_data_entry_t*) ReserveArena(
+        CACHE_MAX_METADATA, sizeof(meta_data_entry_t), initial_metadata_nodes);
+
+    cache->name_stringtable = (char*) ReserveArena(
+        CACHE_MAX_NAME_BYTES, 1, initial_name_storage_capacity);
+    name_slot_t* name_slots_mem = (name_slot_t*) calloc(
+        initial_name_slots, sizeof(name_slot_t));
+    handle_slot_t* handle_slots_mem = (handle_slot_t*) calloc(
+        initial_handle_slots, sizeof(handle_slot_t));
+
+    cache->dir_entries = (cached_dir_t*) ReserveArena(
+        CACHE_MAX_DIRS, sizeof(cached_dir_t), initial_dir_nodes);
+    cache->file_entries = (cached_file_t*) ReserveArena(
+        CACHE_MAX_FILES, sizeof(cached_file_t), initial_files_capacity);
+    cache->limbs = (uint32_t*) ReserveArena(
+        CACHE_MAX_LIMBS, sizeof(uint32_t), initial_limb_capacity);
+
+    assert(cache->toc_entries && cache->root && cache->name_stringtable
+        && name_slots_mem && cache->dir_entries
+        && cache->file_entries && cache->limbs && handle_slots_mem);
 
     cache->toc_size = 0;
     cache->toc_capacity = initial_toc_capacity;
+    cache->toc_hash = toc_hash_mem;
+    cache->toc_hash_mask = initial_toc_capacity * 2 - 1;
 
     cache->metadata_size = 1;
     cache->metadata_capacity = initial_metadata_nodes;
 
-    cache->name_stringtable  = (char*)(cache_memory + sizeof(cache_t));
     cache->name_stringtable_size = 0;
     cache->name_stringtable_capacity = initial_name_storage_capacity;
 
-    cache->name_cache_root = tree_mem;
-    cache->name_cache_node_size = 1;
-    cache->name_cache_node_capacity = initial_name_nodes_capacity;
+    cache->name_slots = name_slots_mem;
+    cache->name_slots_mask = initial_name_slots - 1;
+    cache->name_count = 0;
+    cache->old_name_slots = 0;
+    cache->old_name_slots_mask = 0;
+    cache->old_name_slots_moved = 0;
 
-    cache->dir_entries = dirs_mem;
     cache->dir_entries_size = 0;
     cache->dir_entries_capacity = initial_dir_nodes;
 
-    cache->file_entries = files_mem;
     cache->file_entries_size = 0;
     cache->file_entries_capacity = initial_files_capacity;
 
-    cache->limbs = limbs_mem;
     cache->limbs_size = 0;
     cache->limbs_capacity = initial_limb_capacity;
 
+    cache->handle_slots = handle_slots_mem;
+    cache->handle_slots_mask = initial_handle_slots - 1;
+    cache->handle_count = 0;
+    cache->handle_prefix_count = 0;
+    cache->handle_candidate_count = 0;
+    cache->handle_samples = 0;
+    memset(&cache->unmatched_handle, 0, sizeof(fhandle3));
+
+    cache->acregmin = 3;
+    cache->acregmax = 60;
+    cache->acdirmin = 30;
+    cache->acdirmax = 60;
+
+    // until FSINFO says otherwise
+    cache->dtpref = 4096;
+    cache->rtmax = 32768;
+    cache->wtmax = 32768;
+
+    cache->negative_entries = 0;
+    cache->negative_capacity = 0;
+
+    cache->access_entries = 0;
+    cache->access_capacity = 0;
+    cache->access_timeout = 0;
+
+    cache->free_dirs = 0;
+    cache->free_files = 0;
+    memset(cache->free_limbs, 0, sizeof(cache->free_limbs));
+    cache->dead_limbs = 0;
+
     ResetCache(cache);
 
-    cache->root->cached_dir = cache->dir_entries + cache->dir_entries_size++;
+    cache->root->type = ENTRY_TYPE_DIRECTORY;
+    cache->root->cached_dir = NewCachedDir(cache);
     cache->root->cached_dir->fullPath = GetOrAddName(cache, "/");
 }
 
@@ -373,25 +419,36 @@ mountlist_t* mountd_dump(int mountd_fd)
     return result;
 }
 
-void ReadWcc(RPCDeserializer* self)
+wcc_data ReadWcc(RPCDeserializer* self)
 {
-    wcc_attr pre_op;
-    fattr3 post_op;
-    if (RPCDeserializer_ReadBool(self))
+    wcc_data result;
+    memset(&result, 0, sizeof(result));
+
+    RPCDeserializer_EnsureSize(self, 4);
+    result.has_before = RPCDeserializer_ReadBool(self);
+    if (result.has_before)
     {
-        pre_op.size = RPCDeserializer_ReadU64(self);
-        uint64_t mtime_u64 = RPCDeserializer_ReadU64(self);
-        pre_op.mtime = *(nfstime3*) &mtime_u64;
-        uint64_t ctime_u64 = RPCDeserializer_ReadU64(self);
-        pre_op.ctime = *(nfstime3*)&ctime_u64;
+        RPCDeserializer_EnsureSize(self, 24);
+        result.before.size = RPCDeserializer_ReadU64(self);
+        result.before.mtime.seconds = RPCDeserializer_ReadU32(self);
+        result.before.mtime.nseconds = RPCDeserializer_ReadU32(self);
+        result.before.ctime.seconds = RPCDeserializer_ReadU32(self);
+        result.before.ctime.nseconds = RPCDeserializer_ReadU32(self);
     }
-    if (RPCDeserializer_ReadBool(self))
+    RPCDeserializer_EnsureSize(self, 4);
+    result.has_after = RPCDeserializer_ReadBool(self);
+    if (result.has_after)
     {
-        post_op = RPCDeserializer_ReadFileAttribs(self);
+        result.after = RPCDeserializer_ReadFileAttribs(self);
     }
+
+    return result;
 }
 
-fhandle3 nfs_create(SOCKET nfs_fd, const fhandle3* parentDir, const char* filename, mode3 mode)
+/// attribs->type is NF3NON if the server did not send attributes
+/// for the new file, dir_wcc may be 0
+fhandle3 nfs_create(SOCKET nfs_fd, const fhandle3* parentDir, const char* filename, mode3 mode
+                  , fattr3* attribs, wcc_data* dir_wcc)
 {
     fhandle3 result = {0};
     RPCSerializer s = {0};
@@ -439,6 +496,8 @@ fhandle3 nfs_create(SOCKET nfs_fd, const fhandle3* parentDir, const char* filena
     if (status != 0) printf("Status: %s\n", nfsstat3_toChars(status));
 
 
+    memset(attribs, 0, sizeof(fattr3));
+
     if (status == 0)
     {
         if (RPCDeserializer_ReadBool(&d))
@@ -446,13 +505,18 @@ fhandle3 nfs_create(SOCKET nfs_fd, const fhandle3* parentDir, const char* filena
             result = RPCDeserializer_ReadFileHandle(&d);
         }
 
+        RPCDeserializer_EnsureSize(&d, 4);
         if (RPCDeserializer_ReadBool(&d))
         {
-            fattr3 attrs = RPCDeserializer_ReadFileAttribs(&d);
+            *attribs = RPCDeserializer_ReadFileAttribs(&d);
         }
     }
 
-    ReadWcc(&d);
+    wcc_data wcc = ReadWcc(&d);
+    if (dir_wcc)
+        *dir_wcc = wcc;
+
+    return result;
 }
 
 
@@ -461,6 +525,414 @@ void nfs_remove(SOCKET nfs_fd, fhandle3* dirHandle, const char* filename, uint32
 
 }
 
+/// fetches the current attributes of a file or directory
+nfsstat3 nfs_getattr(SOCKET nfs_fd, const fhandle3* handle, fattr3* attribs)
+{
+    RPCSerializer s = {0};
+
+    uint32_t getattr_xid = RPCSerializer_InitCall(&s,
+        NFS_PROGRAM, 3, NFS_GETATTR_PROCEDURE);
+
+    PushUnixAuthN(&s);
+
+    uint32_t length = fhandle3_length(handle);
+    RPCSerializer_PushString(&s, length, (const char*)handle->handle);
+
+    RPCSerializer_Finalize(&s);
+    RPCSerializer_Send(&s, nfs_fd);
+    // ----------------------------------------------
+    RPCDeserializer d = {0};
+    RPCDeserializer_Init(&d, nfs_fd);
+
+    RPCHeader header = RPCDeserializer_RecvHeader(&d);
+
+    assert(header.xid == getattr_xid);
+
+    int accepted = RPCDeserializer_ReadBool(&d);
+    RPCDeserializer_SkipAuth(&d);
+    int accept_state = RPCDeserializer_ReadBool(&d);
+
+    memset(attribs, 0, sizeof(fattr3));
+    // a call the server didn't accept has no nfs status
+    if (accepted || accept_state)
+        return NFS3ERR_SERVERFAULT;
+
+    nfsstat3 status = (nfsstat3)RPCDeserializer_ReadU32(&d);
+    // -----------------------------------------------------
+
+    if (status == NFS3ERR_OK)
+    {
+        *attribs = RPCDeserializer_ReadFileAttribs(&d);
+    }
+    else
+    {
+        printf("Status: %s\n", nfsstat3_toChars(status));
+    }
+
+    return status;
+}
+
+/// asks which of the ACCESS3_* bits in access uid/gid with the
+/// supplementary groups gids is granted on handle
+/// post_op->type is NF3NON if the server did not send attributes
+nfsstat3 nfs_access(SOCKET nfs_fd, const fhandle3* handle
+                  , uint32_t uid, uint32_t gid
+                  , uint32_t n_gids, const uint32_t gids[]
+                  , uint32_t access
+                  , uint32_t* granted, fattr3* post_op)
+{
+    RPCSerializer s = {0};
+
+    uint32_t access_xid = RPCSerializer_InitCall(&s,
+        NFS_PROGRAM, 3, NFS_ACCESS_PROCEDURE);
+
+    // the server decides for the caller, not for us
+    if (n_gids > AUTH_UNIX_MAX_GIDS)
+        n_gids = AUTH_UNIX_MAX_GIDS;
+    RPCSerializer_PushUnixAuth(&s, 0, "", uid, gid, n_gids, gids);
+
+    uint32_t length = fhandle3_length(handle);
+    RPCSerializer_PushString(&s, length, (const char*)handle->handle);
+    RPCSerializer_PushU32(&s, access);
+
+    RPCSerializer_Finalize(&s);
+    RPCSerializer_Send(&s, nfs_fd);
+    // ----------------------------------------------
+    RPCDeserializer d = {0};
+    RPCDeserializer_Init(&d, nfs_fd);
+
+    RPCHeader header = RPCDeserializer_RecvHeader(&d);
+
+    assert(header.xid == access_xid);
+
+    int accepted = RPCDeserializer_ReadBool(&d);
+    RPCDeserializer_SkipAuth(&d);
+    int accept_state = RPCDeserializer_ReadBool(&d);
+
+    memset(post_op, 0, sizeof(fattr3));
+    *granted = 0;
+    // a call the server didn't accept has no nfs status
+    if (accepted || accept_state)
+        return NFS3ERR_SERVERFAULT;
+
+    nfsstat3 status = (nfsstat3)RPCDeserializer_ReadU32(&d);
+    // -----------------------------------------------------
+
+    if (RPCDeserializer_ReadU32(&d) != 0)
+    {
+        *post_op = RPCDeserializer_ReadFileAttribs(&d);
+    }
+
+    if (status == NFS3ERR_OK)
+    {
+        *granted = RPCDeserializer_ReadU32(&d);
+    }
+    else
+    {
+        printf("Status: %s\n", nfsstat3_toChars(status));
+    }
+
+    return status;
+}
+
+/// reads the target of a symlink into target, NUL terminated
+/// post_op->type is NF3NON if the server did not send attributes
+nfsstat3 nfs_readlink(SOCKET nfs_fd, const fhandle3* link
+                    , char target[1024], uint32_t* target_length
+                    , fattr3* post_op)
+{
+    RPCSerializer s = {0};
+
+    uint32_t readlink_xid = RPCSerializer_InitCall(&s,
+        NFS_PROGRAM, 3, NFS_READLINK_PROCEDURE);
+
+    PushUnixAuthN(&s);
+
+    uint32_t length = fhandle3_length(link);
+    RPCSerializer_PushString(&s, length, (const char*)link->handle);
+
+    RPCSerializer_Finalize(&s);
+    RPCSerializer_Send(&s, nfs_fd);
+    // ----------------------------------------------
+    RPCDeserializer d = {0};
+    RPCDeserializer_Init(&d, nfs_fd);
+
+    RPCHeader header = RPCDeserializer_RecvHeader(&d);
+
+    assert(header.xid == readlink_xid);
+
+    int accepted = RPCDeserializer_ReadBool(&d);
+    RPCDeserializer_SkipAuth(&d);
+    int accept_state = RPCDeserializer_ReadBool(&d);
+
+    memset(post_op, 0, sizeof(fattr3));
+    *target_length = 0;
+    target[0] = '\0';
+    // a call the server didn't accept has no nfs status
+    if (accepted || accept_state)
+        return NFS3ERR_SERVERFAULT;
+
+    nfsstat3 status = (nfsstat3)RPCDeserializer_ReadU32(&d);
+    // -----------------------------------------------------
+
+    if (RPCDeserializer_ReadU32(&d) != 0)
+    {
+        *post_op = RPCDeserializer_ReadFileAttribs(&d);
+    }
+
+    if (status == NFS3ERR_OK)
+    {
+        uint32_t path_length = RPCDeserializer_ReadU32(&d);
+        // MAXPATHLEN of the protocol is 1024 including the terminator
+        if (path_length >= 1024)
+            return NFS3ERR_NAMETOOLONG;
+
+        RPCDeserializer_EnsureSize(&d, ALIGN4(path_length));
+        char* writePtr = target;
+        RPCDeserializer_ReadString(&d, &writePtr, path_length);
+        *target_length = path_length;
+    }
+    else
+    {
+        printf("Status: %s\n", nfsstat3_toChars(status));
+    }
+
+    return status;
+}
+
+/// resolves a single name in a directory
+/// attribs->type is NF3NON if the server did not send attributes
+nfsstat3 nfs_lookup(SOCKET nfs_fd, const fhandle3* dir
+                  , const char* name, uint32_t name_length
+                  , fhandle3* handle, fattr3* attribs)
+{
+    RPCSerializer s = {0};
+
+    uint32_t lookup_xid = RPCSerializer_InitCall(&s,
+        NFS_PROGRAM, 3, NFS_LOOKUP_PROCEDURE);
+
+    PushUnixAuthN(&s);
+
+    uint32_t length = fhandle3_length(dir);
+    RPCSerializer_PushString(&s, length, (const char*)dir->handle);
+    RPCSerializer_PushString(&s, name_length, name);
+
+    RPCSerializer_Finalize(&s);
+    RPCSerializer_Send(&s, nfs_fd);
+    // ----------------------------------------------
+    RPCDeserializer d = {0};
+    RPCDeserializer_Init(&d, nfs_fd);
+
+    RPCHeader header = RPCDeserializer_RecvHeader(&d);
+
+    assert(header.xid == lookup_xid);
+
+    int accepted = RPCDeserializer_ReadBool(&d);
+    RPCDeserializer_SkipAuth(&d);
+    int accept_state = RPCDeserializer_ReadBool(&d);
+
+    memset(attribs, 0, sizeof(fattr3));
+    // a call the server didn't accept has no nfs status
+    if (accepted || accept_state)
+        return NFS3ERR_SERVERFAULT;
+
+    nfsstat3 status = (nfsstat3)RPCDeserializer_ReadU32(&d);
+    // -----------------------------------------------------
+
+    if (status == NFS3ERR_OK)
+    {
+        *handle = RPCDeserializer_ReadFileHandle(&d);
+
+        RPCDeserializer_EnsureSize(&d, 4);
+        if (RPCDeserializer_ReadBool(&d))
+        {
+            *attribs = RPCDeserializer_ReadFileAttribs(&d);
+        }
+    }
+    else if (status != NFS3ERR_NOENT)
+    {
+        printf("Status: %s\n", nfsstat3_toChars(status));
+    }
+
+    return status;
+}
+
+/// how many calls nfs_call_many keeps in flight on one connection
+/// small enough that requests and replies fit into the socket buffers
+#define NFS_PIPELINE_DEPTH 128
+
+/// encodes the arguments of call i after the auth
+typedef void (*nfs_encode_fn)(RPCSerializer* s, uint32_t i, void* userData);
+/// decodes the reply of call i after its status
+typedef void (*nfs_decode_fn)(RPCDeserializer* d, uint32_t i,
+                              nfsstat3 status, void* userData);
+
+/// sends n calls of procedure proc as bursts of NFS_PIPELINE_DEPTH
+/// and matches the replies by xid in whatever order they arrive
+/// statuses[i] is NFS3ERR_SERVERFAULT for calls without a usable reply
+/// Returns: how many calls came back with NFS3ERR_OK or -1 if the
+///          connection failed, nfs_fd is out of step then and has to be
+///          replaced by a new connection
+int nfs_call_many(SOCKET nfs_fd, uint32_t proc, uint32_t n,
+                       nfs_encode_fn encode, nfs_decode_fn decode,
+                       nfsstat3 statuses[], void* userData)
+{
+    int succeeded = 0;
+    uint8_t* burst = (uint8_t*) malloc(NFS_PIPELINE_DEPTH
+                                       * sizeof(((RPCSerializer*)0)->InlineStorage));
+    uint32_t xids[NFS_PIPELINE_DEPTH];
+
+    for(uint32_t i = 0; i < n; i++)
+        statuses[i] = NFS3ERR_SERVERFAULT;
+
+    for(uint32_t first = 0; first < n; first += NFS_PIPELINE_DEPTH)
+    {
+        uint32_t count = n - first;
+        if (count > NFS_PIPELINE_DEPTH)
+            count = NFS_PIPELINE_DEPTH;
+
+        // everything is encoded up front and leaves in one send
+        uint32_t burst_size = 0;
+        for(uint32_t j = 0; j < count; j++)
+        {
+            RPCSerializer s = {0};
+            xids[j] = RPCSerializer_InitCall(&s, NFS_PROGRAM, 3, proc);
+            PushUnixAuthN(&s);
+            encode(&s, first + j, userData);
+            RPCSerializer_Finalize(&s);
+
+            memcpy(burst + burst_size, s.BufferPtr, s.Size + sizeof(u32));
+            burst_size += s.Size + sizeof(u32);
+        }
+
+        for(uint32_t sent = 0; sent < burst_size;)
+        {
+            int n_sent = send(nfs_fd, (const char*)burst + sent, burst_size - sent, 0);
+            if (n_sent <= 0)
+                goto Lfailed;
+            sent += n_sent;
+        }
+        // ----------------------------------------------
+        // replies to nothing in this burst don't count
+        for(uint32_t received = 0; received < count;)
+        {
+            RPCDeserializer d = {0};
+            RPCDeserializer_Init(&d, nfs_fd);
+
+            RPCHeader header;
+            int res = RPCDeserializer_RecvRecord(&d, &header);
+            if (res < 0)
+                goto Lfailed;
+
+            uint32_t j = 0;
+            while (j < count && xids[j] != header.xid)
+                j++;
+            if (j == count)
+                continue;
+            // a duplicate must not decode into the same result twice
+            xids[j] = PLACEHOLDER_XID;
+            received++;
+            // too big to be read, the call stays NFS3ERR_SERVERFAULT
+            if (res == 0)
+                continue;
+
+            int accepted = RPCDeserializer_ReadBool(&d);
+            RPCDeserializer_SkipAuth(&d);
+            int accept_state = RPCDeserializer_ReadBool(&d);
+            if (accepted || accept_state)
+                continue;
+
+            nfsstat3 status = (nfsstat3)RPCDeserializer_ReadU32(&d);
+            statuses[first + j] = status;
+            decode(&d, first + j, status, userData);
+            succeeded += (status == NFS3ERR_OK);
+        }
+    }
+
+    free(burst);
+    return succeeded;
+
+Lfailed:
+    free(burst);
+    return -1;
+}
+
+typedef struct getattr_many_args_t
+{
+    const fhandle3* handles;
+    fattr3* results;
+} getattr_many_args_t;
+
+static void EncodeGetattr_cb(RPCSerializer* s, uint32_t i, void* userData)
+{
+    getattr_many_args_t* args = (getattr_many_args_t*) userData;
+    const fhandle3* handle = args->handles + i;
+    RPCSerializer_PushString(s, fhandle3_length(handle), (const char*)handle->handle);
+}
+
+static void DecodeGetattr_cb(RPCDeserializer* d, uint32_t i,
+                             nfsstat3 status, void* userData)
+{
+    getattr_many_args_t* args = (getattr_many_args_t*) userData;
+    if (status == NFS3ERR_OK)
+        args->results[i] = RPCDeserializer_ReadFileAttribs(d);
+}
+
+/// GETATTR for n handles with the calls pipelined on nfs_fd
+/// results[i] has NF3NON as type unless statuses[i] is NFS3ERR_OK
+/// Returns: how many succeeded or -1 like nfs_call_many
+int nfs_getattr_many(SOCKET nfs_fd, const fhandle3 handles[], uint32_t n,
+                          fattr3 results[], nfsstat3 statuses[])
+{
+    memset(results, 0, n * sizeof(fattr3));
+
+    getattr_many_args_t args = { handles, results };
+    return nfs_call_many(nfs_fd, NFS_GETATTR_PROCEDURE, n,
+                         EncodeGetattr_cb, DecodeGetattr_cb, statuses, &args);
+}
+
+typedef struct lookup_many_args_t
+{
+    const fhandle3* dir;
+    const char* const* names;
+    fhandle3* handles;
+    fattr3* attribs;
+} lookup_many_args_t;
+
+static void EncodeLookup_cb(RPCSerializer* s, uint32_t i, void* userData)
+{
+    lookup_many_args_t* args = (lookup_many_args_t*) userData;
+    RPCSerializer_PushString(s, fhandle3_length(args->dir), (const char*)args->dir->handle);
+    RPCSerializer_PushString(s, strlen(args->names[i]), args->names[i]);
+}
+
+static void DecodeLookup_cb(RPCDeserializer* d, uint32_t i,
+                            nfsstat3 status, void* userData)
+{
+    lookup_many_args_t* args = (lookup_many_args_t*) userData;
+    if (status != NFS3ERR_OK)
+        return;
+
+    args->handles[i] = RPCDeserializer_ReadFileHandle(d);
+    if (RPCDeserializer_ReadBool(d))
+        args->attribs[i] = RPCDeserializer_ReadFileAttribs(d);
+}
+
+/// LOOKUP of n names in dir with the calls pipelined on nfs_fd
+/// attribs[i] has NF3NON as type if the server didn't send them
+/// Returns: how many names were found or -1 like nfs_call_many
+int nfs_lookup_many(SOCKET nfs_fd, const fhandle3* dir,
+                         const char* const names[], uint32_t n,
+                         fhandle3 handles[], fattr3 attribs[], nfsstat3 statuses[])
+{
+    memset(handles, 0, n * sizeof(fhandle3));
+    memset(attribs, 0, n * sizeof(fattr3));
+
+    lookup_many_args_t args = { dir, names, handles, attribs };
+    return nfs_call_many(nfs_fd, NFS_LOOKUP_PROCEDURE, n,
+                         EncodeLookup_cb, DecodeLookup_cb, statuses, &args);
+}
+
 fhandle3 nfs_mknod(SOCKET nfs_sock_fd, const fhandle3* parentDir, const char* filename)
 {
     fhandle3 result = {0};
@@ -486,9 +958,10 @@ fhandle3 nfs_mknod(SOCKET nfs_sock_fd, const fhandle3* parentDir, const char* fi
     return result;
 }
 
+/// wcc may be 0, otherwise it receives the attributes around the write
 int64_t nfs_write(SOCKET nfs_fd, const fhandle3* file
                , const void* data, uint32_t size
-               , uint64_t offset)
+               , uint64_t offset, wcc_data* wcc)
 {
     RPCSerializer s = {0};
 
@@ -524,6 +997,10 @@ int64_t nfs_write(SOCKET nfs_fd, const fhandle3* file
     if (status != 0) printf("Status: %s\n", nfsstat3_toChars(status));
     // -----------------------------------------------------
 
+    wcc_data file_wcc = ReadWcc(&d);
+    if (wcc)
+        *wcc = file_wcc;
+
     if (status)
     {
         fprintf(stderr, "Error [%s] while reading '%s'\n"
@@ -535,7 +1012,6 @@ int64_t nfs_write(SOCKET nfs_fd, const fhandle3* file
 
     if (status == 0)
     {
-        ReadWcc(&d);
         uint32_t count =
             RPCDeserializer_ReadU32(&d);
         stable_how comitted = (stable_how) RPCDeserializer_ReadU32(&d);
@@ -545,9 +1021,11 @@ int64_t nfs_write(SOCKET nfs_fd, const fhandle3* file
 }
 
 
+/// post_op may be 0, otherwise it receives the attributes after the read
+/// post_op->type is NF3NON if the server did not send them
 int64_t nfs_read(SOCKET nfs_fd, const fhandle3* file
                , void* data, uint32_t size
-               , uint64_t offset)
+               , uint64_t offset, fattr3* post_op)
 {
     RPCSerializer s = {0};
 
@@ -579,6 +1057,9 @@ int64_t nfs_read(SOCKET nfs_fd, const fhandle3* file
     if (status != 0) printf("Status: %s\n", nfsstat3_toChars(status));
     // -----------------------------------------------------
 
+    if (post_op)
+        memset(post_op, 0, sizeof(fattr3));
+
     if (status)
     {
         fprintf(stderr, "Error [%s] while reading '%s'\n"
@@ -591,7 +1072,9 @@ int64_t nfs_read(SOCKET nfs_fd, const fhandle3* file
     //TODO FIXME make sure size if less than rtMax form FSINFO Query!
     if (RPCDeserializer_ReadU32(&d) != 0)
     {
-        (void) RPCDeserializer_ReadFileAttribs(&d);
+        fattr3 attribs = RPCDeserializer_ReadFileAttribs(&d);
+        if (post_op)
+            *post_op = attribs;
     }
     uint32_t result_count = RPCDeserializer_ReadU32(&d);
     int eof = RPCDeserializer_ReadU32(&d) != 0;
@@ -625,8 +1108,129 @@ int64_t nfs_read(SOCKET nfs_fd, const fhandle3* file
     return result_count;
 }
 
+/// sizes of the READDIR(PLUS) pages of one listing
+/// the first page is small since most directories are, every
+/// page after it grows until it hits what the server prefers
+typedef struct readdir_window_t
+{
+    uint32_t dircount;
+    uint32_t maxcount;
+    uint32_t max_dircount;
+    uint32_t max_maxcount;
+} readdir_window_t;
+
+readdir_window_t ReaddirWindow(const cache_t* cache)
+{
+    readdir_window_t window;
+    window.max_dircount = cache->dtpref;
+    window.max_maxcount = cache->rtmax;
+    window.dircount = 1024;
+    window.maxcount = 4096;
+    if (window.dircount > window.max_dircount)
+        window.dircount = window.max_dircount;
+    if (window.maxcount > window.max_maxcount)
+        window.maxcount = window.max_maxcount;
+
+    return window;
+}
+
+/// Returns: 0 if the window was at its maximum already
+int GrowReaddirWindow(readdir_window_t* window)
+{
+    const readdir_window_t old = *window;
+
+    window->dircount *= 4;
+    window->maxcount *= 4;
+    if (window->dircount > window->max_dircount)
+        window->dircount = window->max_dircount;
+    if (window->maxcount > window->max_maxcount)
+        window->maxcount = window->max_maxcount;
+
+    return window->dircount != old.dircount
+        || window->maxcount != old.maxcount;
+}
+
+/// asks the server for its preferred and maximum transfer sizes
+nfsstat3 nfs_fsinfo(SOCKET nfs_fd, const fhandle3* root, fsinfo3* info)
+{
+    RPCSerializer s = {0};
+
+    uint32_t fsinfo_xid = RPCSerializer_InitCall(&s,
+        NFS_PROGRAM, 3, NFS_FSINFO_PROCEDURE);
+
+    PushUnixAuthN(&s);
+
+    uint32_t length = fhandle3_length(root);
+    RPCSerializer_PushString(&s, length, (const char*)root->handle);
+
+    RPCSerializer_Finalize(&s);
+    RPCSerializer_Send(&s, nfs_fd);
+    // ----------------------------------------------
+    RPCDeserializer d = {0};
+    RPCDeserializer_Init(&d, nfs_fd);
+
+    RPCHeader header = RPCDeserializer_RecvHeader(&d);
+
+    assert(header.xid == fsinfo_xid);
+
+    int accepted = RPCDeserializer_ReadBool(&d);
+    RPCDeserializer_SkipAuth(&d);
+    int accept_state = RPCDeserializer_ReadBool(&d);
+
+    memset(info, 0, sizeof(fsinfo3));
+    // a call the server didn't accept has no nfs status
+    if (accepted || accept_state)
+        return NFS3ERR_SERVERFAULT;
+
+    nfsstat3 status = (nfsstat3)RPCDeserializer_ReadU32(&d);
+    // -----------------------------------------------------
+
+    if (RPCDeserializer_ReadU32(&d) != 0)
+    {
+        RPCDeserializer_ReadFileAttribs(&d);
+    }
+
+    if (status == NFS3ERR_OK)
+    {
+        info->rtmax = RPCDeserializer_ReadU32(&d);
+        info->rtpref = RPCDeserializer_ReadU32(&d);
+        info->rtmult = RPCDeserializer_ReadU32(&d);
+        info->wtmax = RPCDeserializer_ReadU32(&d);
+        info->wtpref = RPCDeserializer_ReadU32(&d);
+        info->wtmult = RPCDeserializer_ReadU32(&d);
+        info->dtpref = RPCDeserializer_ReadU32(&d);
+        info->maxfilesize = RPCDeserializer_ReadU64(&d);
+        info->time_delta.seconds = RPCDeserializer_ReadU32(&d);
+        info->time_delta.nseconds = RPCDeserializer_ReadU32(&d);
+        info->properties = RPCDeserializer_ReadU32(&d);
+    }
+    else
+    {
+        printf("Status: %s\n", nfsstat3_toChars(status));
+    }
+
+    return status;
+}
+
+/// takes the transfer sizes of the server into the cache
+void ApplyFsinfo(cache_t* cache, const fsinfo3* info)
+{
+    // a page has to hold at least one entry
+    if (info->dtpref >= 1024)
+        cache->dtpref = info->dtpref;
+    if (info->rtmax >= 4096)
+        cache->rtmax = info->rtmax;
+    if (info->wtmax >= 4096)
+        cache->wtmax = info->wtmax;
+}
+
+/// window may be 0 for the old fixed sizes, otherwise it grows
+/// with every page that doesn't end the listing
+/// Returns: 1 while there is more to read, 0 once the server reported
+///          the end of the directory or fileIter stopped, -1 on an error
 int nfs_readdirplus(SOCKET nfs_fd, const fhandle3* dir
                , uint64_t *cookie, uint64_t *cookieverf
+               , readdir_window_t* window
                , int (*fileIter)(const char* fName, const fhandle3* handle,
                                  const fattr3* attribs,
                                  void* userData)
@@ -656,10 +1260,11 @@ int nfs_readdirplus(SOCKET nfs_fd, const fhandle3* dir
     RPCSerializer_PushU32(&s, cookie_verif_hi);
     RPCSerializer_PushU32(&s, cookie_verif_lw);
 
-    RPCSerializer_PushU32(&s, 4096);
-    // max size of attribs ... it's recommeded that that's shorter than max size
+    // size of the names and cookies, it's recommended to be below maxcount
+    RPCSerializer_PushU32(&s, window ? window->dircount : 4096);
 
-    RPCSerializer_PushU32(&s, 32768); // max size of result structure
+    // max size of result structure
+    RPCSerializer_PushU32(&s, window ? window->maxcount : 32768);
 
     RPCSerializer_Finalize(&s);
     RPCSerializer_Send(&s, nfs_fd);
@@ -675,9 +1280,26 @@ int nfs_readdirplus(SOCKET nfs_fd, const fhandle3* dir
     int accepted = RPCDeserializer_ReadBool(&d);  //16
     RPCDeserializer_SkipAuth(&d);
     int accept_state = RPCDeserializer_ReadBool(&d);
+    // what is left of a failed reply, like the directory attributes,
+    // would be read by the next call on nfs_fd
+    if (accepted || accept_state)
+    {
+        RPCDeserializer_SkipRecord(&d);
+        return -1;
+    }
 
     nfsstat3 status = (nfsstat3)RPCDeserializer_ReadU32(&d);
-    if (status != 0) printf("Status: %s\n", nfsstat3_toChars(status));
+    if (status == NFS3ERR_TOOSMALL && window && GrowReaddirWindow(window))
+    {
+        // the next entry didn't fit, ask again from the same cookie
+        return RPCDeserializer_SkipRecord(&d) ? 1 : -1;
+    }
+    if (status != 0)
+    {
+        printf("Status: %s\n", nfsstat3_toChars(status));
+        RPCDeserializer_SkipRecord(&d);
+        return -1;
+    }
     // -------------------------------------------------------------------
 
     int hasAttrs = RPCDeserializer_ReadBool(&d);
@@ -687,7 +1309,8 @@ int nfs_readdirplus(SOCKET nfs_fd, const fhandle3* dir
     }
 
     *cookieverf = RPCDeserializer_ReadU64(&d);
-    cookie3 lastCookie;
+    // an empty page leaves the cookie where it was
+    cookie3 lastCookie = *cookie;
     // ---------------------------------------------------------------------
     int hasNext = RPCDeserializer_ReadBool(&d);
     int shouldContinueReading;
@@ -707,12 +1330,17 @@ int nfs_readdirplus(SOCKET nfs_fd, const fhandle3* dir
         RPCDeserializer_EnsureSize(&d, 12);
         lastCookie = RPCDeserializer_ReadU64(&d);
 
+        // attribs and handle have to outlive the blocks below
+        // since fileIter gets pointers to them
+        fattr3 attribs;
+        fhandle3 handle;
+
         const fattr3* attribsPtr = 0;
         uint32_t bufferLeftBeforeAttribs;
         if (RPCDeserializer_ReadBool(&d))
         {
             bufferLeftBeforeAttribs = RPCDeserializer_BufferLeft(&d);
-            const fattr3 attribs = RPCDeserializer_ReadFileAttribs(&d);
+            attribs = RPCDeserializer_ReadFileAttribs(&d);
             attribsPtr = &attribs;
         }
 
@@ -720,7 +1348,7 @@ int nfs_readdirplus(SOCKET nfs_fd, const fhandle3* dir
         RPCDeserializer_EnsureSize(&d, 4);
         if (RPCDeserializer_ReadBool(&d))
         {
-            const fhandle3 handle = RPCDeserializer_ReadFileHandle(&d);
+            handle = RPCDeserializer_ReadFileHandle(&d);
             handlePtr = &handle;
         }
 
@@ -747,6 +1375,9 @@ int nfs_readdirplus(SOCKET nfs_fd, const fhandle3* dir
     *cookie = lastCookie;
     RPCDeserializer_EnsureSize(&d, 4);
     shouldContinueReading = !RPCDeserializer_ReadBool(&d);
+    // a directory which needs more than one page is likely a big one
+    if (shouldContinueReading && window)
+        GrowReaddirWindow(window);
 Lreturn:
     return shouldContinueReading;
 
@@ -754,6 +1385,7 @@ Lreturn:
 
 int nfs_readdir(int nfs_fd, const fhandle3* dir
                , uint64_t *cookie, uint64_t *cookieverf
+               , readdir_window_t* window
                , int (*dirIter)(const char* fName, uint64_t fileId) )
 {
     RPCSerializer s = {0};
@@ -781,7 +1413,8 @@ int nfs_readdir(int nfs_fd, const fhandle3* dir
     RPCSerializer_PushU32(&s, cookie_verif_hi);
     RPCSerializer_PushU32(&s, cookie_verif_lw);
 
-    RPCSerializer_PushU32(&s, 2048); // max size of result structure
+    // max size of result structure
+    RPCSerializer_PushU32(&s, window ? window->maxcount : 2048);
 
     RPCSerializer_Finalize(&s);
     RPCSerializer_Send(&s, nfs_fd);
@@ -871,37 +1504,73 @@ int populateCache_cb(const char* fName, const fhandle3* handle,
 
     const uint32_t len = strlen(fName);
     meta_data_entry_t* entry = 0;
+    int isNew = 0;
+
+    const int isDotOrDotDot = (fName[0] == '.')
+        && (fName[1] == '\0' || (fName[1] == '.' && fName[2] == '\0'));
 
     if (attribs)
     {
+        if (!parentDir->cached_dir)
+        {
+            parentDir->cached_dir = NewCachedDir(cache);
+        }
+
+        // the entry might exist already if it was looked up before
+        // the directory got listed or if the directory is listed again
+        meta_data_entry_t* existing =
+            LookupInDirectory(cache, parentDir->cached_dir, fName, len);
+        const entry_type_t type =
+            (attribs->type == NF3DIR) ? ENTRY_TYPE_DIRECTORY :
+            (attribs->type == NF3REG) ? ENTRY_TYPE_FILE :
+            (attribs->type == NF3LNK) ? ENTRY_TYPE_SYMLINK :
+                                        ENTRY_TYPE_NONE;
+        if (existing && existing->type != type)
+        {
+            // it changed its type on the server, start over
+            RemoveEntry(cache, parentDir->cached_dir, existing);
+            existing = 0;
+        }
+        isNew = !existing;
+
         if (attribs->type == NF3DIR)
         {
-            if (!parentDir->cached_dir)
+            entry = GetOrCreateSubdirectory(cache, parentDir->cached_dir, fName, len);
+            if (!entry)
             {
-                parentDir->cached_dir = cache->dir_entries + cache->dir_entries_size++;
+                return 1;
             }
-            entry = GetOrCreateSubdirectory(cache, parentDir->cached_dir, fName, len);
-            if (
-                   (fName[0] != '.' && fName[1] != '\0')
-                && (fName[0] != '.' && fName[1] != '.' && fName[2] != '\0')
-            )
+            if (!isDotOrDotDot)
             {
-                // printf("reading dir: %s\n", fName);
-                uint64_t cookie = 0;
-                uint64_t verifier = 0;
-                populate_cache_cb_args_t newArgs = {
-                    args->cache, entry
-                };
-
-                SOCKET newSock = connect_name("192.168.178.26", "2049");
-                nfs_readdirplus(newSock, handle, &cookie, &verifier
-                  , populateCache_cb, &newArgs);
-                closesocket(newSock);
+                UpdateAttribs(cache, entry, attribs, (uint32_t)time(0));
+                // the caller lists it later, on its own connection
+                if (isNew)
+                    entry->flags |= ENTRY_FLAG_UNLISTED;
             }
         }
         else if (attribs->type == NF3REG)
         {
-            entry = CreateFileEntry(cache, parentDir, fName, len);
+            entry = existing;
+            if (!entry)
+            {
+                entry = CreateFileEntry(cache, parentDir, fName, len);
+            }
+            if (UpdateAttribs(cache, entry, attribs, (uint32_t)time(0)))
+            {
+                InvalidateFileBlocks(entry->cached_file);
+            }
+            entry->cached_file->size = attribs->size;
+        }
+        else if (attribs->type == NF3LNK)
+        {
+            entry = existing;
+            if (!entry)
+            {
+                entry = CreateSymlinkEntry(cache, parentDir, fName, len);
+            }
+            // the target is read on first use and again once the
+            // ctime moves, which is what changing a link does
+            UpdateAttribs(cache, entry, attribs, (uint32_t)time(0));
             entry->cached_file->size = attribs->size;
         }
         else
@@ -914,14 +1583,72 @@ int populateCache_cb(const char* fName, const fhandle3* handle,
     {
         printf("No attribs for: %s\n", fName);
     }
-    if (handle)
+    if (handle && entry)
     {
-        entry->handle = handleToPtr(cache, handle);
+        // only store the handle again if it changed, a new handle
+        // under the same name means the old content is gone
+        fhandle3 cachedHandle;
+        if (!isNew)
+            cachedHandle = ptrToHandle(cache, entry->handle);
+        if (isNew || memcmp(&cachedHandle, handle, sizeof(fhandle3)))
+        {
+            if (!isNew && !isDotOrDotDot)
+            {
+                if (entry->type == ENTRY_TYPE_DIRECTORY)
+                    entry->flags |= ENTRY_FLAG_UNLISTED;
+                else if (entry->type == ENTRY_TYPE_SYMLINK)
+                    entry->cached_file->link_target.v = 0;
+                else
+                    InvalidateFileBlocks(entry->cached_file);
+            }
+            if (!isNew)
+                FreeHandle(cache, entry->handle);
+            entry->handle = handleToPtr(cache, handle);
+        }
+    }
+    if (entry)
+    {
+        entry->flags |= ENTRY_FLAG_LISTED;
     }
 
     return 1;
 }
 
+/// lists dir and every directory below it, one after the other on nfs_fd
+/// Returns: the number of directories which could not be listed
+uint32_t nfs_populate_tree(cache_t* cache, SOCKET nfs_fd, meta_data_entry_t* dir)
+{
+    const fhandle3 handle = ptrToHandle(cache, dir->handle);
+    cookie3 cookie = 0;
+    cookie3 verifier = 0;
+    readdir_window_t window = ReaddirWindow(cache);
+    populate_cache_cb_args_t args = { cache, dir };
+    int status;
+
+    while ((status = nfs_readdirplus(nfs_fd, &handle, &cookie, &verifier
+                                   , &window, populateCache_cb, &args)) > 0)
+    {
+    }
+    if (status < 0)
+    {
+        return 1;
+    }
+    dir->flags &= ~ENTRY_FLAG_UNLISTED;
+
+    uint32_t failed = 0;
+    for(uint32_t i = 0; dir->cached_dir && i < dir->cached_dir->entries_size; i++)
+    {
+        meta_data_entry_t* entry = DirEntry(dir->cached_dir, i);
+        if (entry->type == ENTRY_TYPE_DIRECTORY
+         && (entry->flags & ENTRY_FLAG_UNLISTED))
+        {
+            failed += nfs_populate_tree(cache, nfs_fd, entry);
+        }
+    }
+
+    return failed;
+}
+
 uint32_t handleSum(const fhandle3* handle)
 {
     uint32_t sum = 0;
@@ -65,58 +65,52 @@ int main(int argc, char* argv[])
     fhandle3 fh = mountd_mnt(mountd_fd, "/nfs/git");
     printFileHandle(&fh);
 
-    int nfs_fd = connect_name("192.168.178.26", "2049");
+    int nfs_fd = connect_name(hostname, "2049");
     cookie3 cookie = 0;
     cookie3 verifier = 0;
 /*
     read_more = nfs_readdir(nfs_fd, &fh
           , &cookie, &verifier
-          , myCallBack
+          , 0, myCallBack
     );
 */
 
     cache_t dirCache;
     InitCache(&dirCache);
     dirCache.rootHandle = fh;
-    populate_cache_cb_args_t args = {&dirCache, dirCache.root};
+    fsinfo3 fsinfo;
+    if (nfs_fsinfo(nfs_fd, &fh, &fsinfo) == NFS3ERR_OK)
+        ApplyFsinfo(&dirCache, &fsinfo);
+    dirCache.root->handle = handleToPtr(&dirCache, &fh);
     struct search_dir_t searchResult = {"ll.txt"};
 
-    for(;;) {
-        cookie3 old_cookie = cookie;
-        int shouldContinueReading =
-        nfs_readdirplus(nfs_fd, &fh
-              , &cookie, &verifier
-              , populateCache_cb, &args
-        );
-        if (!shouldContinueReading)
-            break;
-    }
+    uint32_t failed = nfs_populate_tree(&dirCache, nfs_fd, dirCache.root);
+    if (failed)
+        fprintf(stderr, "Could not list %u directories\n", failed);
 
-    cached_dir_t root = *dirCache.root->cached_dir;
-    meta_data_entry_t* one_past_last_entry =
-        root.entries + root.entries_size;
+    // an empty export or a failed listing leaves the root without entries
+    const cached_dir_t* root = dirCache.root->cached_dir;
 
     printf("root_entrires:\n");
-    for(meta_data_entry_t* entry = root.entries;
-         entry < one_past_last_entry; entry++)
+    for(uint32_t i = 0; root && i < root->entries_size; i++)
     {
-        printf("%d: ", (int)(entry - root.entries));
+        meta_data_entry_t* entry = DirEntry(root, i);
+        printf("%d: ", (int)i);
         printf("\t%s\n", dirCache.name_stringtable + (entry->name.v - 4));
 
-        if (entry->type == ENTRY_TYPE_DIRECTORY)
+        if (entry->type == ENTRY_TYPE_DIRECTORY && entry->cached_dir)
         {
             printf("d");
-            for(meta_data_entry_t* e = entry->cached_dir->entries;
-                e < entry->cached_dir->entries + entry->cached_dir->entries_size;
-                e++)
+            for(uint32_t j = 0; j < entry->cached_dir->entries_size; j++)
             {
+                const meta_data_entry_t* e = DirEntry(entry->cached_dir, j);
                 printf("\t\t%s\n", dirCache.name_stringtable + (e->name.v -4));
             }
         }
         const fhandle3 handle = ptrToHandle(&dirCache, entry->handle);
         // printFileHandle(&handle);
     }
-    meta_data_entry_t* div =
+    meta_data_entry_t* div = !root ? 0 :
         LookupInDirectory(&dirCache, dirCache.root->cached_dir, "division.html", strlen("division.html"));
     if (div && div->type == ENTRY_TYPE_FILE)
     {
@@ -130,7 +124,7 @@ int main(int argc, char* argv[])
        printFileHandle(&searchResult.result_handle);
        char buf[512];
        int size_read =
-            nfs_read(nfs_fd, &searchResult.result_handle, buf, sizeof(buf), 0);
+            nfs_read(nfs_fd, &searchResult.result_handle, buf, sizeof(buf), 0, 0);
        buf[size_read] = '\0';
 
        printf("data read: %s\n", buf);
@@ -146,10 +146,97 @@ RPCHeader RPCDeserializer_RecvHeader(RPCDeserializer* self)
     return result;
 }
 
+static int RecvAll(SOCKET sock_fd, char* buffer, uint32_t size)
+{
+    for(uint32_t received = 0; received < size;)
+    {
+        int n = recv(sock_fd, buffer + received, size - received, 0);
+        if (n <= 0)
+            return 0;
+        received += n;
+    }
+    return 1;
+}
+
+static int SkipAll(SOCKET sock_fd, uint32_t size)
+{
+    char skip[256];
+    while (size)
+    {
+        uint32_t chunk = size < sizeof(skip) ? size : sizeof(skip);
+        if (!RecvAll(sock_fd, skip, chunk))
+            return 0;
+        size -= chunk;
+    }
+    return 1;
+}
+
+int RPCDeserializer_RecvRecord(RPCDeserializer* self, RPCHeader* header)
+{
+    char* record = (char*)self->BufferPtr + 4;
+    const uint32_t capacity = self->MaxBuffer - 4;
+    uint32_t length = 0;
+    int fits = 1;
+
+    // a record can be split into fragments, bit 31 marks the last one
+    for(uint32_t mark = 0; !(mark & (1u << 31));)
+    {
+        uint32_t raw_mark;
+        if (!RecvAll(self->SockFd, (char*)&raw_mark, sizeof(raw_mark)))
+            return -1;
+        mark = HTONL(raw_mark);
+        const uint32_t fragment = mark & ~(1u << 31);
+
+        uint32_t kept = capacity - length;
+        if (fragment <= kept)
+            kept = fragment;
+        else
+            fits = 0;
+        if (!RecvAll(self->SockFd, record + length, kept))
+            return -1;
+        length += kept;
+
+        // drain the rest, the replies behind it are still good
+        if (!SkipAll(self->SockFd, fragment - kept))
+            return -1;
+    }
+
+    // even a reply which didn't fit tells which call it answered
+    header->xid = (length >= 4) ? HTONL(*(uint32_t*)record) : 0;
+    if (!fits || length < sizeof(RPCHeader) - 4)
+        return 0;
+
+    *(uint32_t*)self->BufferPtr = HTONL(length | (1u << 31));
+
+    self->Size = length + 4;
+    self->FragmentSizeLeft = 0;
+    self->ReadPtr = (const uint32_t*)self->BufferPtr + 1;
+
+    header->size_final = length | (1u << 31);
+    header->xid = HTONL(*self->ReadPtr); self->ReadPtr++;
+    header->reply = (*self->ReadPtr++) != 0;
+
+    return 1;
+}
+
+int RPCDeserializer_SkipRecord(RPCDeserializer* self)
+{
+    const int ok = (self->FragmentSizeLeft <= 0)
+                || SkipAll(self->SockFd, (uint32_t)self->FragmentSizeLeft);
+
+    self->FragmentSizeLeft = 0;
+    self->Size = 0;
+    self->ReadPtr = (const uint32_t*)self->BufferPtr;
+    return ok;
+}
+
 static inline void RPCDeserializer_RefillBuffer(RPCDeserializer* self)
 {
     const int32_t oldSize = RPCDeserializer_BufferLeft(self);
     assert(oldSize >= 0);
+    // the record is complete, whatever comes now belongs to the next one
+    if (self->FragmentSizeLeft <= 0)
+        return;
     memmove(self->BufferPtr, self->ReadPtr, oldSize);
 
     int RecivedBytes =
@@ -230,11 +317,16 @@ fhandle3 RPCDeserializer_ReadFileHandle(RPCDeserializer* self)
 
     self->ReadPtr += (length >> 2) + !!(length & 3);
 
+    // a longer one breaks the protocol, it's returned as no handle
+    if (length > NFS3_FHSIZE)
+        return result;
+
     for(int i = 0; i < length; i++)
     {
         result.handle[i] = *fhReadPtr++;
 
     }
+    result.length = length;
 
     return result;
 }
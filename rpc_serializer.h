@@ -14,6 +14,10 @@
 # include <winsock2.h>
 #endif
 
+#ifdef _MSC_VER
+#  include <intrin.h>
+#endif
+
 #pragma pack(push, 1)
 typedef uint32_t u32;
 
@@ -105,22 +109,26 @@ int RPCSerializer_Send(RPCSerializer* self, SOCKET sock_fd);
 #  endif
 #endif
 
+#define PLACEHOLDER_XID 0x1234ABCD
+
+/// unique for 2^32 calls and safe to call from several threads
 static inline uint32_t RandomXid()
 {
-    static uint32_t i = 0;
-    static const uint32_t arr[] = {
-        0x12874512,
-        0x12845512,
-        0x12874235,
-        0x12874232,
-        0x12882513
-    };
-
-    return arr[i++ % sizeof(arr)];
+    static volatile uint32_t counter = 0;
+#ifdef _MSC_VER
+    const uint32_t n = (uint32_t)_InterlockedIncrement((volatile long*)&counter);
+#else
+    const uint32_t n = __sync_add_and_fetch(&counter, 1);
+#endif
+    // odd multiplier, so distinct counters give distinct xids
+    uint32_t xid = n * 0x9E3779B1;
+    // the placeholder tells InitCall to pick one
+    if (xid == PLACEHOLDER_XID)
+        xid++;
+    return xid;
 }
 
 
-#define PLACEHOLDER_XID 0x1234ABCD
 #define PREP_RPC_CALL(PROG, PROG_VER, PROC) \
     PREP_RPC_CALL_XID(PROG, PROG_VER, PROC, PLACEHOLDER_XID)
 
@@ -196,6 +204,15 @@ static inline int RPCDeserializer_ReadBool(RPCDeserializer *self)
 
 void RPCDeserializer_Init(RPCDeserializer* self, SOCKET sock_fd);
 RPCHeader RPCDeserializer_RecvHeader(RPCDeserializer* self);
+/// like RecvHeader but takes exactly one record off the socket,
+/// all of its fragments, needed when further replies are in flight behind it
+/// Returns: 1, 0 if the record didn't fit and was skipped, header->xid is
+///          still set if it could be read, or -1 if the connection broke
+int RPCDeserializer_RecvRecord(RPCDeserializer* self, RPCHeader* header);
+/// drops what is left of the record RecvHeader started, so the next
+/// call on the socket reads its own reply
+/// Returns: 0 if the connection broke
+int RPCDeserializer_SkipRecord(RPCDeserializer* self);
 void RPCDeserializer_SkipAuth(RPCDeserializer *self);
 
 const char* RPCDeserializer_ReadString(RPCDeserializer* self
@@ -8,7 +8,7 @@ if [ -d "$1" ]; then
     mkdir -p $DST/cache
     cp cache/cached_tree.c cache/cached_tree.h cache/crc32.c $DST/cache
     mkdir -p $DST/fuse
-    cp fuse/cnfs_main.c fuse/micronfs_glue.c fuse/bld.sh $DST/fuse
+    cp fuse/cnfs_main.c fuse/micronfs_glue.c fuse/micronfs_glue.h fuse/bld.sh $DST/fuse
     chmod +x $DST/fuse/bld.sh
     mkdir -p $DST/rfcs
     cp rfcs/rfc1057_sun_rpc_v2.txt  rfcs/rfc1813_nfs_v3.txt  rfcs/rfc1833_rpcbind.txt $DST/rfcs